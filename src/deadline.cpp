@@ -0,0 +1,18 @@
+#include "deadline.h"
+#include <Arduino.h>
+#include <algorithm>
+
+// millis() starts from zero on every wake
+static uint32_t deadline = 0;
+
+void beginPhase(const WakeType wake_type) {
+    // time left over from the previous phase isn't carried over
+    deadline = std::min(millis(), (unsigned long)deadline) + WAKE_BUDGETS[(uint8_t)wake_type];
+}
+bool deadlineExceeded() {
+    return millis() >= deadline;
+}
+uint32_t remainingTime() {
+    const uint32_t now = millis();
+    return now >= deadline ? 0 : deadline - now;
+}
@@ -0,0 +1,27 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <cstdint>
+
+enum class WakeType : uint8_t {
+    NightRender,
+    DaySync,
+    Recovery,
+};
+
+// ms, indexed by WakeType
+const uint32_t WAKE_BUDGETS[] = {
+    60000,  // night render, two panel refreshes at most
+    240000, // day sync, the random batch dominates
+    120000, // recovery, only the time and the errors are essential
+};
+// ms, a connect takes a few seconds, so a bad access point doesn't keep the radio on for a whole budget
+const uint32_t CONNECT_TIMEOUT = 20000;
+
+// a wake that syncs and renders begins the render as another phase, so the whole wake is bounded by the sum of the budgets
+void beginPhase(const WakeType wake_type);
+bool deadlineExceeded();
+// ms until the deadline, 0 if it has passed
+uint32_t remainingTime();
+
+#endif // !DEADLINE_H
@@ -4,16 +4,43 @@
 
 #include "epd.h"
 #include "storage.h"
+#include "deadline.h"
 #include <SD.h>
+#include <LittleFS.h>
 #include <SPI.h>
 #include <EEPROM.h>
 #include <user_interface.h>
 
 using namespace std;
 
-// public:
+// pixels are counted in halves of a byte, the first one is in the high nibble
+static inline uint8_t getPixel(const uint8_t *const bytes, const uint32_t pixel) {
+    return (bytes[pixel / 2] >> (pixel & 1 ? 0 : 4)) & 0x07;
+}
+static inline void setPixel(uint8_t *const bytes, const uint32_t pixel, const uint8_t color) {
+    uint8_t *const byte = bytes + pixel / 2;
+    *byte = pixel & 1 ? (*byte & 0xf0) | color : (*byte & 0x0f) | (color << 4);
+}
+
+// epd public:
+
+// scale, rotate
+tuple<uint8_t, bool> Epd::layout(const uint16_t image_width, const uint16_t image_height) {
+    const uint32_t width_pixels = (uint32_t)image_width * 2;
+    for (uint8_t scale = 1; scale <= MAX_SCALE; scale += 1) {
+        const uint32_t scaled_width = (width_pixels + scale - 1) / scale;
+        const uint32_t scaled_height = ((uint32_t)image_height + scale - 1) / scale;
+        if (scaled_width <= (uint32_t)WIDTH * 2 && scaled_height <= HEIGHT) return tuple(scale, false);
+        if (scaled_height <= (uint32_t)WIDTH * 2 && scaled_width <= HEIGHT) return tuple(scale, true);
+    }
+    return tuple(0, false);
+}
+
+// the panel is refreshing and the power off and the deep sleep commands are still due
+static bool refreshing = false;
 
 Epd::Epd() {
+    finishRefresh();
     //pinMode(PWR_PIN, OUTPUT);
     pinMode(BUSY_PIN, INPUT); 
     pinMode(RST_PIN, OUTPUT);
@@ -73,6 +100,9 @@ Epd::Epd() {
     digitalWrite(CS_PIN, HIGH);
 }
 Epd::~Epd() {
+    if (!refreshing) sleepPanel();
+}
+void Epd::sleepPanel() {
     digitalWrite(CS_PIN, LOW);
     sendCommand(0x07);
     sendData(0xA5);
@@ -88,51 +118,257 @@ void Epd::reset() {
     delay(200);    
 }
 
-void Epd::clear(const Color color) {
-    digitalWrite(CS_PIN, LOW);
-    setResolution();
+DisplayResult Epd::clear(const Color color) {
     startImageTransfer();
+    digitalWrite(CS_PIN, LOW);
     for (uint32_t i = 0; i < (uint32_t)WIDTH * (uint32_t)HEIGHT; i += 1) {
         SPI.transfer(((uint8_t)color << 4) | (uint8_t)color);
     }
-    refresh();
     digitalWrite(CS_PIN, HIGH);
+    return refresh();
+}
+DisplayResult Epd::loadPalette() {
+    return renderer.loadPalette();
 }
 DisplayResult Epd::displayFile(File file) {
+    Panel panel;
+    startImageTransfer();
+    const DisplayResult result = renderer.renderFile(file, &panel);
+    if (result != DisplayResult::Ok) return result;
+    return refresh();
+}
+DisplayResult Epd::displayStream(Stream *const stream, const uint16_t image_width, const uint16_t image_height) {
+    Panel panel;
+    startImageTransfer();
+    const DisplayResult result = renderer.renderStream(stream, image_width, image_height, &panel);
+    if (result != DisplayResult::Ok) return result;
+    return refresh();
+}
+// the frame is already in the order of the panel
+DisplayResult Epd::displayFrame(File frame) {
+    if (frame.available() != (int)((uint32_t)WIDTH * HEIGHT)) return DisplayResult::WrongLength;
+    Panel panel;
+    startImageTransfer();
+    uint8_t row[WIDTH];
+    for (uint16_t y = 0; y < HEIGHT; y += 1) {
+        yield();
+        if (frame.read(row, WIDTH) != WIDTH) return DisplayResult::TooShort;
+        panel.write(row, WIDTH);
+    }
+    return refresh();
+}
+
+// renderer:
+
+// without the palette file the color codes are sent as they are
+DisplayResult Renderer::loadPalette() {
+    yield();
+    if (!SD.exists(PALETTE_FILE)) return DisplayResult::Ok;
+    File file = sdOpen(PALETTE_FILE, FILE_READ);
+    if (!file) return DisplayResult::Empty;
+    remap = file.available() == sizeof(palette) && sdRead(&file, palette, sizeof(palette)) == sizeof(palette);
+    file.close();
+    return remap ? DisplayResult::Ok : DisplayResult::WrongLength;
+}
+DisplayResult Renderer::renderFile(File file, Print *const out) {
     if (!file.available()) return DisplayResult::Empty;
     if (file.available() < 2) return DisplayResult::TooShort;
     const uint16_t image_width = file.read() | (file.read() << 8);
-    if (image_width > WIDTH) return DisplayResult::TooLarge;
-    if (file.available() % image_width != 0) return DisplayResult::WrongLength;
-    const uint16_t image_height = file.available() / image_width;
-    if (image_height > HEIGHT) return DisplayResult::TooLarge;
+    if (image_width & TILED_IMAGE) return renderTiled(&file, image_width & ~TILED_IMAGE, out);
+    if (!image_width || file.available() % image_width != 0) return DisplayResult::WrongLength;
+    const uint32_t image_height = file.available() / image_width;
+    if (image_height > 0xffff) return DisplayResult::TooLarge;
+    const auto [scale, rotate] = Epd::layout(image_width, image_height);
+    if (!scale) return DisplayResult::TooLarge;
+    if (scale == 1 && !rotate) return renderStream(&file, image_width, image_height, out, true);
+    return renderTransformed(&file, image_width, image_height, scale, rotate, out);
+}
+DisplayResult Renderer::renderStream(Stream *const stream, const uint16_t image_width, const uint16_t image_height, Print *const out, const bool from_sd) {
+    if (image_width > Epd::WIDTH || image_height > Epd::HEIGHT) return DisplayResult::TooLarge;
+    const uint16_t image_x = (Epd::WIDTH - image_width) / 2;
+    const uint16_t image_y = (Epd::HEIGHT - image_height) / 2;
+
+    uint8_t row[Epd::WIDTH];
+    for (uint16_t y = 0; y < Epd::HEIGHT; y += 1) {
+        yield();
+        memset(row, 0x11, Epd::WIDTH);
+        if (y >= image_y && y < image_y + image_height) {
+            const uint32_t start = micros();
+            if (stream->readBytes(row + image_x, image_width) != image_width) return DisplayResult::TooShort;
+            if (from_sd) recordSd(SdOperation::Read, start);
+            if (remap) for (uint16_t x = image_x; x < image_x + image_width; x += 1) row[x] = palette[row[x]];
+        }
+        if (out->write(row, Epd::WIDTH) != Epd::WIDTH) return DisplayResult::WriteFailed;
+    }
+    return DisplayResult::Ok;
+}
+
+// the image is rendered in strips of rows, rotated images are read in tiles of STRIP_HEIGHT source columns,
+// a band of source rows per seek
+DisplayResult Renderer::renderTransformed(File *const file, const uint16_t image_width, const uint16_t image_height, const uint8_t scale, const bool rotate, Print *const out) {
+    const uint16_t WIDTH = Epd::WIDTH;
+    const uint16_t HEIGHT = Epd::HEIGHT;
+    const uint32_t width_pixels = (uint32_t)image_width * 2;
+    const uint16_t out_width = ((rotate ? image_height : width_pixels) + scale - 1) / scale; // in pixels
+    const uint16_t out_height = ((rotate ? width_pixels : image_height) + scale - 1) / scale;
+    const uint16_t image_x = (WIDTH * 2 - out_width) / 2; // in pixels
+    const uint16_t image_y = (HEIGHT - out_height) / 2;
+
+    uint8_t strip_height = Epd::STRIP_HEIGHT;
+    uint8_t *strip;
+    while (!(strip = (uint8_t *)malloc((size_t)strip_height * WIDTH))) {
+        strip_height /= 2;
+        if (!strip_height) return DisplayResult::OutOfMemory;
+    }
+    uint8_t tile[Epd::STRIP_HEIGHT * Epd::MAX_SCALE / 2 + 1];
+    // without the heap for a band every source row is a seek of its own
+    size_t band_size = rotate ? Epd::BAND_SIZE : 0;
+    uint8_t *band = nullptr;
+    while (band_size > sizeof(tile) && !(band = (uint8_t *)malloc(band_size))) band_size /= 2;
+    if (!band) {
+        band = tile;
+        band_size = sizeof(tile);
+    }
+
+    DisplayResult result = DisplayResult::Ok;
+    for (uint16_t strip_y = 0; strip_y < HEIGHT && result == DisplayResult::Ok; strip_y += strip_height) {
+        yield();
+        const uint16_t rows = std::min<uint16_t>(strip_height, HEIGHT - strip_y);
+        memset(strip, 0x11, (size_t)rows * WIDTH);
+
+        // image rows within this strip
+        const uint16_t first = std::max(strip_y, image_y) - image_y;
+        const uint16_t last = std::min<uint16_t>(strip_y + rows, image_y + out_height) - image_y;
+        if (strip_y + rows > image_y && first < last) {
+            if (rotate) {
+                // image row y is the source column y * scale, image column x is the source row image_height - 1 - x * scale
+                const uint32_t first_byte = (uint32_t)first * scale / 2;
+                const size_t tile_len = (uint32_t)(last - 1) * scale / 2 - first_byte + 1;
+                // the columns go up the source, the band is read from the row of its last column on;
+                // rows further apart than a block would make the card read the blocks between them
+                const uint32_t stride = (uint32_t)scale * image_width;
+                const uint16_t band_rows = stride <= SD_BLOCK_SIZE ? (band_size - tile_len) / stride + 1 : 1;
+                uint16_t band_end = 0; // the column after the band
+                for (uint16_t x = 0; x < out_width; x += 1) {
+                    if (x == band_end) {
+                        band_end = std::min<uint32_t>(x + band_rows, out_width);
+                        const uint32_t source_row = image_height - 1 - (uint32_t)(band_end - 1) * scale;
+                        const size_t band_len = (size_t)(band_end - 1 - x) * stride + tile_len;
+                        if (!file->seek(2 + source_row * image_width + first_byte) || sdRead(file, band, band_len) != band_len) {
+                            result = DisplayResult::TooShort;
+                            break;
+                        }
+                    }
+                    uint8_t *const source = band + (size_t)(band_end - 1 - x) * stride;
+                    if (remap) for (size_t i = 0; i < tile_len; i += 1) source[i] = palette[source[i]];
+                    for (uint16_t y = first; y < last; y += 1)
+                        setPixel(strip + (size_t)(image_y + y - strip_y) * WIDTH, image_x + x, getPixel(source, (uint32_t)y * scale - first_byte * 2));
+                }
+            } else for (uint16_t y = first; y < last && result == DisplayResult::Ok; y += 1) {
+                uint8_t *const row = strip + (size_t)(image_y + y - strip_y) * WIDTH;
+                if (!file->seek(2 + (uint32_t)y * scale * image_width)) { result = DisplayResult::TooShort; break; }
+                uint32_t tile_start = 0;
+                uint32_t tile_end = 0;
+                for (uint16_t x = 0; x < out_width; x += 1) {
+                    const uint32_t column = (uint32_t)x * scale;
+                    while (column / 2 >= tile_end) {
+                        const size_t tile_len = std::min<uint32_t>(sizeof(tile), image_width - tile_end);
+                        if (sdRead(file, tile, tile_len) != tile_len) { result = DisplayResult::TooShort; break; }
+                        if (remap) for (size_t i = 0; i < tile_len; i += 1) tile[i] = palette[tile[i]];
+                        tile_start = tile_end;
+                        tile_end += tile_len;
+                    }
+                    if (result != DisplayResult::Ok) break;
+                    setPixel(row, image_x + x, getPixel(tile, column - tile_start * 2));
+                }
+            }
+        }
+        if (result == DisplayResult::Ok && out->write(strip, (size_t)rows * WIDTH) != (size_t)rows * WIDTH) result = DisplayResult::WriteFailed;
+    }
+    if (band != tile) free(band);
+    free(strip);
+    return result;
+}
+
+// the width is followed by the height, the generation of the dictionary and the tile numbers, a row of tiles after another
+DisplayResult Renderer::renderTiled(File *const file, const uint16_t image_width, Print *const out) {
+    const uint16_t WIDTH = Epd::WIDTH;
+    if (file->available() < 3) return DisplayResult::TooShort;
+    const uint16_t image_height = file->read() | (file->read() << 8);
+    const uint8_t generation = file->read();
+    if (!image_width || !image_height) return DisplayResult::WrongLength;
+    if (image_width > WIDTH || image_height > Epd::HEIGHT) return DisplayResult::TooLarge;
+    const uint8_t tiles_x = (image_width + TILE_WIDTH - 1) / TILE_WIDTH;
+    const uint8_t tiles_y = (image_height + TILE_WIDTH - 1) / TILE_WIDTH;
+    if (file->available() != (int)((uint32_t)tiles_x * tiles_y * 2)) return DisplayResult::WrongLength;
     const uint16_t image_x = (WIDTH - image_width) / 2;
-    const uint16_t image_y = (HEIGHT - image_height) / 2;
+    const uint16_t image_y = (Epd::HEIGHT - image_height) / 2;
 
-    digitalWrite(CS_PIN, LOW);
-    setResolution();
-    startImageTransfer();
+    yield();
+    File tiles = sdOpen(TILES_FILE);
+    if (!tiles) return DisplayResult::ReadOpenFailed;
+    // the image belongs to a dictionary that was replaced
+    if (tiles.read() != generation) {
+        tiles.close();
+        return DisplayResult::WrongLength;
+    }
+    const uint32_t tile_count = (tiles.size() - 1) / TILE_SIZE;
+    uint8_t *const band = (uint8_t *)malloc((size_t)TILE_WIDTH * WIDTH);
+    if (!band) {
+        tiles.close();
+        return DisplayResult::OutOfMemory;
+    }
+    uint8_t numbers[(WIDTH + TILE_WIDTH - 1) / TILE_WIDTH * 2];
+    uint8_t tile[TILE_SIZE];
 
-    for (uint16_t y = 0; y < HEIGHT; y += 1) for (uint16_t x = 0; x < WIDTH; x += 1) {
-        uint8_t byte;
-        if (y >= image_y && y < image_y + image_height && x >= image_x && x < image_x + image_width) {
-            digitalWrite(CS_PIN, HIGH);
-            byte = file.read();
-            digitalWrite(CS_PIN, LOW);
-        } else byte = 0x11;
-        SPI.transfer(byte);
+    DisplayResult result = DisplayResult::Ok;
+    for (uint16_t y = 0; y < Epd::HEIGHT && result == DisplayResult::Ok;) {
+        yield();
+        const bool inside = y >= image_y && y < image_y + image_height;
+        const uint8_t rows = inside ? std::min<uint16_t>(TILE_WIDTH, image_y + image_height - y) : 1;
+        memset(band, 0x11, (size_t)rows * WIDTH);
+        if (inside) {
+            if (sdRead(file, numbers, tiles_x * 2) != (size_t)tiles_x * 2) { result = DisplayResult::TooShort; break; }
+            for (uint8_t tile_x = 0; tile_x < tiles_x; tile_x += 1) {
+                const uint16_t number = numbers[tile_x * 2] | (numbers[tile_x * 2 + 1] << 8);
+                // the server cut the dictionary back below the tiles of this image
+                if (number >= tile_count) { result = DisplayResult::WrongLength; break; }
+                // runs of consecutive tiles are read without seeking
+                const uint32_t offset = 1 + (uint32_t)number * TILE_SIZE;
+                if (tiles.position() != offset && !tiles.seek(offset)) { result = DisplayResult::TooShort; break; }
+                if (sdRead(&tiles, tile, TILE_SIZE) != TILE_SIZE) { result = DisplayResult::TooShort; break; }
+                const uint16_t x = tile_x * TILE_WIDTH;
+                const uint8_t columns = std::min<uint16_t>(TILE_WIDTH, image_width - x);
+                for (uint8_t row = 0; row < rows; row += 1) memcpy(band + (size_t)row * WIDTH + image_x + x, tile + row * TILE_WIDTH, columns);
+            }
+            if (remap) for (uint8_t row = 0; row < rows; row += 1)
+                for (uint16_t x = image_x; x < image_x + image_width; x += 1) band[(size_t)row * WIDTH + x] = palette[band[(size_t)row * WIDTH + x]];
+        }
+        if (result == DisplayResult::Ok && out->write(band, (size_t)rows * WIDTH) != (size_t)rows * WIDTH) result = DisplayResult::WriteFailed;
+        y += rows;
     }
+    free(band);
+    tiles.close();
+    return result;
+}
+
+// epd private:
 
-    refresh();
+// the panel is only selected while writing, the images may be read from the sd card on the same bus
+size_t Epd::Panel::write(const uint8_t data) {
+    return write(&data, 1);
+}
+size_t Epd::Panel::write(const uint8_t *buffer, size_t size) {
+    digitalWrite(CS_PIN, LOW);
+    SPI.writeBytes(buffer, size);
     digitalWrite(CS_PIN, HIGH);
-    return DisplayResult::Ok;
+    return size;
 }
 
-// private:
-
+// polled finely, the wake ends with the refresh; the deadline doesn't apply, a cut refresh leaves the panel half drawn
 void Epd::busyHigh() {
-    for (uint8_t t = 0; t < 60; t += 1) {
-        delay(500);
+    for (uint16_t t = 0; t < BUSY_TIMEOUT / BUSY_POLL; t += 1) {
+        delay(BUSY_POLL);
         if (digitalRead(BUSY_PIN)) break;
     }
 }
@@ -166,48 +402,69 @@ void Epd::setResolution() {
     SPI.transfer(0x01);
     SPI.transfer(0xC0);
 }
+// the panel is deselected afterwards
 void Epd::startImageTransfer() {
+    digitalWrite(CS_PIN, LOW);
+    setResolution();
     sendCommand(0x10); // 8 start data transmission
     dataMode();
+    digitalWrite(CS_PIN, HIGH);
 }
-void Epd::refresh() {
+// the panel is deselected while it refreshes, so the sd card can use the bus
+DisplayResult Epd::refresh() {
+    finishRefresh();
+    if (deadlineExceeded()) return DisplayResult::DeadlineExceeded;
+    digitalWrite(CS_PIN, LOW);
     commandMode();
     SPI.transfer(0x04); // 5 power on
     busyHigh();
     SPI.transfer(0x12); // 10 display refresh
+    digitalWrite(CS_PIN, HIGH);
+    refreshing = true;
+    return DisplayResult::Ok;
+}
+void Epd::finishRefresh() {
+    if (!refreshing) return;
+    refreshing = false;
     busyHigh();
+    // the sd card may have taken the bus meanwhile, at its own clock
+    SPI.beginTransaction(SPISettings(2000000, MSBFIRST, SPI_MODE0));
+    digitalWrite(CS_PIN, LOW);
+    commandMode();
     SPI.transfer(0x02); // 3 power off
     //busyLow();
     delay(1);
+    digitalWrite(CS_PIN, HIGH);
+    sleepPanel();
 }
 
 // non class:
 
 // rand_file_count, next_image, rollover
-tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const error_count) {
+tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count) {
     Epd epd;
+    const DisplayResult palette_result = epd.loadPalette();
+    if (palette_result != DisplayResult::Ok) writeError(error_count, Type::NightGeneric, (Result)palette_result);
     const auto [count_success, next_rand_file] = randFileCount();
     if (!count_success) writeError(error_count, Type::NightGeneric, Result::FilesMissing);
 
+    // tonight's entry of the schedule, most nights have none
     yield();
-    File file = SD.open(RECENT_FILE, FILE_READ);
-    if (file) {
+    const RecentName recent_name = recentName(days_until_recent_check);
+    File file;
+    if (days_until_recent_check && (file = sdOpen(recent_name.bytes, FILE_READ))) {
         const DisplayResult recent_result = epd.displayFile(file);
         file.close();
-
-        if (!(file = SD.open(RECENT_FILE, FILE_WRITE))) writeError(error_count, Type::NightRecent, Result::WriteOpenFailed);
-        else if (!file.truncate(0)) writeError(error_count, Type::NightRecent, Result::ClearFailed);
-        file.close();
+        // a slow card leaves it for the next recent check, which removes the whole schedule
+        if (!sdSlow() && !sdRemove(recent_name.bytes)) writeError(error_count, Type::NightRecent, Result::RemoveFailed);
 
         if (recent_result == DisplayResult::Ok) {
             if (EEPROM.read(EPD_CLEARED_ADDRESS)) EEPROM.write(EPD_CLEARED_ADDRESS, 0);
             return tuple(next_rand_file, next_image, false);
         }
         else if (recent_result != DisplayResult::Empty) writeError(error_count, Type::NightRecent, (Result)recent_result);
-    } else {
-        writeError(error_count, Type::NightRecent, Result::ReadOpenFailed);
-        if ((file = SD.open(RECENT_FILE, FILE_WRITE))) file.close();
-        else writeError(error_count, Type::NightRecent, Result::CreateFailed);
+        // no other image would be refreshed either
+        if (recent_result == DisplayResult::DeadlineExceeded) return tuple(next_rand_file, next_image, false);
     }
 
     if (next_rand_file == 0) return tuple(0, 0, false);
@@ -216,7 +473,7 @@ tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const err
     uint8_t new_next_image = next_image;
     while (true) {
         yield();
-        if ((file = SD.open(numToName(new_next_image++).bytes))) {
+        if ((file = sdOpen(numToName(new_next_image++).bytes))) {
             const DisplayResult result = epd.displayFile(file);
             file.close();
             if (result == DisplayResult::Ok) {
@@ -224,6 +481,8 @@ tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const err
                 break;
             }
             writeError(error_count, Type::NightRand, (Result)result);
+            // the image is fine, it is shown the next night
+            if (result == DisplayResult::DeadlineExceeded) return tuple(next_rand_file, next_image, false);
             rand_file_count -= 1;
         } else {
             writeError(error_count, Type::NightRand, Result::ReadOpenFailed);
@@ -232,8 +491,9 @@ tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const err
 
         if (rand_file_count == 0 || new_next_image == next_image) {
             if (!EEPROM.read(EPD_CLEARED_ADDRESS)) {
-                epd.clear(Color::White);
-                EEPROM.write(EPD_CLEARED_ADDRESS, 1);
+                const DisplayResult clear_result = epd.clear(Color::White);
+                if (clear_result == DisplayResult::Ok) EEPROM.write(EPD_CLEARED_ADDRESS, 1);
+                else writeError(error_count, Type::NightGeneric, (Result)clear_result);
             }
             break;
         }
@@ -242,9 +502,106 @@ tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const err
     return tuple(rand_file_count, new_next_image, new_next_image <= next_image);
 }
 
-void clearEpd() {
-    if (EEPROM.read(EPD_CLEARED_ADDRESS)) return;
-    Epd epd;
-    epd.clear(Color::White);
-    EEPROM.write(EPD_CLEARED_ADDRESS, 1);
+// the frame starts with the source, the image index and the rand file count, followed by the rows of the panel
+void cacheFrame(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count) {
+    const RecentName recent_name = recentName(days_until_recent_check);
+    // an earlier wake of the day moved tonight's recent image into the frame already,
+    // it is only rebuilt when a later sync saved the image again
+    File cached = LittleFS.open(FRAME_FILE, "r");
+    if (cached) {
+        uint8_t header[3];
+        const bool current = days_until_recent_check && cached.read(header, sizeof(header)) == sizeof(header) &&
+                             (FrameSource)header[0] == FrameSource::Recent && header[1] == days_until_recent_check;
+        cached.close();
+        yield();
+        if (current && !SD.exists(recent_name.bytes)) return;
+    }
+    LittleFS.remove(FRAME_FILE);
+    const auto [count_success, rand_file_count] = randFileCount();
+    if (!count_success) return; // reported by the night
+
+    // the same choice night() makes first
+    FrameSource source = FrameSource::Recent;
+    uint8_t index = days_until_recent_check;
+    yield();
+    File file;
+    if (days_until_recent_check) file = sdOpen(recent_name.bytes, FILE_READ);
+    if (!file || !file.available()) {
+        if (file) file.close();
+        if (!rand_file_count) return;
+        source = FrameSource::Rand;
+        index = next_image < rand_file_count ? next_image : 0;
+        if (!(file = sdOpen(numToName(index).bytes))) return;
+    }
+
+    File frame = LittleFS.open(FRAME_FILE, "w");
+    if (!frame) {
+        file.close();
+        writeError(error_count, Type::DayGeneric, Result::CreateFailed);
+        return;
+    }
+    const uint8_t header[3] = { (uint8_t)source, index, rand_file_count };
+    DisplayResult result = DisplayResult::WriteFailed;
+    if (frame.write(header, sizeof(header)) == sizeof(header)) {
+        Renderer renderer;
+        renderer.loadPalette();
+        result = renderer.renderFile(file, &frame);
+    }
+    file.close();
+    frame.close();
+
+    // broken images are left for night() to skip and report
+    if (result != DisplayResult::Ok) {
+        LittleFS.remove(FRAME_FILE);
+        if (result == DisplayResult::WriteFailed || result == DisplayResult::OutOfMemory) writeError(error_count, Type::DayGeneric, (Result)result);
+        return;
+    }
+    // the recent image lives in the cache now, as night() would remove it after displaying
+    if (source == FrameSource::Recent && !sdSlow() && !sdRemove(recent_name.bytes)) writeError(error_count, Type::DayRecent, Result::RemoveFailed);
+}
+// displayed, rand_file_count, next_image, rollover
+tuple<bool, uint8_t, uint8_t, bool> nightFrame(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count) {
+    File frame = LittleFS.open(FRAME_FILE, "r");
+    if (!frame) return tuple(false, 0, 0, false);
+
+    uint8_t header[3];
+    DisplayResult result = DisplayResult::WrongLength;
+    if (frame.read(header, sizeof(header)) == sizeof(header)) {
+        const FrameSource source = (FrameSource)header[0];
+        const uint8_t index = header[1];
+        const uint8_t rand_file_count = header[2];
+        // the state moved on since the frame was cached
+        if (source == FrameSource::Recent && index != days_until_recent_check) result = DisplayResult::Empty;
+        else if (source == FrameSource::Rand && index != (next_image < rand_file_count ? next_image : 0)) result = DisplayResult::Empty;
+        else {
+            Epd epd;
+            result = epd.displayFrame(frame);
+        }
+        frame.close();
+        LittleFS.remove(FRAME_FILE);
+
+        if (result == DisplayResult::Ok) {
+            if (EEPROM.read(EPD_CLEARED_ADDRESS)) EEPROM.write(EPD_CLEARED_ADDRESS, 0);
+            if (source == FrameSource::Recent) return tuple(true, rand_file_count, next_image, false);
+            return tuple(true, rand_file_count, index + 1, index < next_image);
+        }
+    } else {
+        frame.close();
+        LittleFS.remove(FRAME_FILE);
+    }
+    if (result != DisplayResult::Empty) writeError(error_count, Type::NightGeneric, (Result)result);
+    return tuple(false, 0, 0, false);
+}
+
+// waits for the refresh, it comes with a low battery or ahead of the radio
+DisplayResult clearEpd() {
+    if (EEPROM.read(EPD_CLEARED_ADDRESS)) return DisplayResult::Ok;
+    DisplayResult result;
+    {
+        Epd epd;
+        result = epd.clear(Color::White);
+    }
+    Epd::finishRefresh();
+    if (result == DisplayResult::Ok) EEPROM.write(EPD_CLEARED_ADDRESS, 1);
+    return result;
 }
@@ -10,10 +10,20 @@
 enum class DisplayResult : uint8_t {
     Ok,
 
-    WrongLength = (uint8_t)Result::WrongLength,
-    TooLarge    = (uint8_t)Result::TooLarge,
-    TooShort    = (uint8_t)Result::TooShort,
-    Empty       = (uint8_t)Result::Empty,
+    WrongLength    = (uint8_t)Result::WrongLength,
+    TooLarge       = (uint8_t)Result::TooLarge,
+    TooShort       = (uint8_t)Result::TooShort,
+    Empty          = (uint8_t)Result::Empty,
+
+    WriteFailed    = (uint8_t)Result::WriteFailed,
+    ReadOpenFailed = (uint8_t)Result::ReadOpenFailed,
+    OutOfMemory    = (uint8_t)Result::OutOfMemory,
+    DeadlineExceeded = (uint8_t)Result::DeadlineExceeded,
+};
+
+enum class FrameSource : uint8_t {
+    Recent,
+    Rand,
 };
 
 enum class Color : uint8_t {
@@ -27,19 +37,50 @@ enum class Color : uint8_t {
     Clean,
 };
 
+// turns images into rows in the order of the panel, without touching the panel itself
+class Renderer {
+    public:
+        DisplayResult loadPalette();
+        DisplayResult renderFile(File file, Print *const out);
+        // from_sd times the reads into the sd card histograms
+        DisplayResult renderStream(Stream *const stream, const uint16_t image_width, const uint16_t image_height, Print *const out, const bool from_sd = false);
+
+    private:
+        // maps the pixel pairs of the images to the codes of this panel
+        uint8_t palette[256];
+        bool remap = false;
+
+        DisplayResult renderTransformed(File *const file, const uint16_t image_width, const uint16_t image_height, const uint8_t scale, const bool rotate, Print *const out);
+        // tiled images fit the panel as they are, they are rebuilt a row of tiles at a time
+        DisplayResult renderTiled(File *const file, const uint16_t image_width, Print *const out);
+};
+
 // Electronic Paper Display
 class Epd {
     public:
         const static uint16_t WIDTH  = 300; // this value is in bytes, 1 byte contains a pair of pixels
         const static uint16_t HEIGHT = 448;
         const static uint8_t CS_PIN  = D4;
+        const static uint8_t MAX_SCALE = 4;
+        const static uint8_t STRIP_HEIGHT = 32; // rows buffered while rotating or scaling
+        const static uint16_t BAND_SIZE = 4096; // bytes of source rows read per seek while rotating
+
+        // scale, rotate; the scale is 0 if the image doesn't fit even when scaled down
+        static std::tuple<uint8_t, bool> layout(const uint16_t image_width, const uint16_t image_height);
+
+        // the refresh goes on in the panel after the object is gone, the state can be written back meanwhile;
+        // finishRefresh() waits for it and puts the panel to sleep, it must come before the radio and the deep sleep
+        static void finishRefresh();
 
         Epd();
         ~Epd();
         void reset();
 
-        void clear(const Color color);
+        DisplayResult clear(const Color color);
+        DisplayResult loadPalette();
         DisplayResult displayFile(File file);
+        DisplayResult displayStream(Stream *const stream, const uint16_t image_width, const uint16_t image_height);
+        DisplayResult displayFrame(File frame);
         //DisplayResult displayRecentFile(const char *const file_name);
         //DisplayResult displayRandFile(const char *const file_name);
 
@@ -48,22 +89,37 @@ class Epd {
         const static uint8_t BUSY_PIN = D1;
         const static uint8_t RST_PIN  = D2;
         const static uint8_t DC_PIN   = D3;
+        const static uint16_t BUSY_TIMEOUT = 30000; // ms
+        const static uint8_t BUSY_POLL = 20;        // ms
+
+        class Panel : public Print {
+            public:
+                size_t write(const uint8_t data) override;
+                size_t write(const uint8_t *buffer, size_t size) override;
+        };
+
+        Renderer renderer;
         
-        void busyHigh();
+        static void busyHigh();
         //void busyLow();
 
-        void commandMode();
-        void dataMode();
-        void sendCommand(const uint8_t command);
-        void sendData(const uint8_t data);
+        static void commandMode();
+        static void dataMode();
+        static void sendCommand(const uint8_t command);
+        static void sendData(const uint8_t data);
+        static void sleepPanel();
 
         void setResolution();
         void startImageTransfer();
-        void refresh();
+        // a refresh isn't started past the deadline, a started one isn't cut short
+        DisplayResult refresh();
 };
 
 // rand_file_count, next_image, rollover
-std::tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, uint8_t *const error_count);
-void clearEpd();
+std::tuple<uint8_t, uint8_t, bool> night(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count);
+void cacheFrame(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count);
+// displayed, rand_file_count, next_image, rollover
+std::tuple<bool, uint8_t, uint8_t, bool> nightFrame(const uint8_t next_image, const uint8_t days_until_recent_check, uint8_t *const error_count);
+DisplayResult clearEpd();
 
 #endif // !EPD_H
@@ -0,0 +1,165 @@
+#include "http.h"
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+using namespace std;
+
+static char host[HTTP_HOST_SIZE];
+static char line[HTTP_LINE_SIZE];
+static uint8_t head[HTTP_HEAD_SIZE];
+static size_t head_length = 0;
+static bool send_failed = false;
+
+static uint32_t min_free_heap = UINT32_MAX;
+static uint8_t max_fragmentation = 0;
+
+bool Http::begin(WiFiClient *const client, const char *const url) {
+    if (strncmp(url, "http://", 7)) return false;
+    const char *const host_start = url + 7;
+    const size_t host_length = strcspn(host_start, ":/");
+    if (host_length == 0 || host_length >= sizeof(host)) return false;
+    memcpy(host, host_start, host_length);
+    host[host_length] = 0;
+
+    const char *rest = host_start + host_length;
+    port = 80;
+    if (*rest == ':') {
+        char *port_end;
+        const unsigned long parsed_port = strtoul(rest + 1, &port_end, 10);
+        if (port_end == rest + 1 || parsed_port == 0 || parsed_port > 65535) return false;
+        port = parsed_port;
+        rest = port_end;
+    }
+    if (*rest != 0 && *rest != '/') return false;
+    path = *rest ? rest : "/";
+
+    client->setTimeout(HTTP_TIMEOUT);
+    if (!client->connect(host, port)) return false;
+    this->client = client;
+    sampleHeap();
+    return true;
+}
+
+bool Http::header(const char *const name, const char *const value) {
+    if (header_count == HTTP_MAX_HEADERS) return false;
+    header_names[header_count] = name;
+    header_values[header_count] = value;
+    header_count += 1;
+    return true;
+}
+
+uint16_t Http::get() {
+    return request("GET", nullptr, 0);
+}
+uint16_t Http::post(const uint8_t *const body, const size_t size) {
+    return request("POST", body, size);
+}
+
+WiFiClient *Http::getStreamPtr() {
+    return client;
+}
+int32_t Http::contentLength() {
+    return content_length;
+}
+
+void Http::end() {
+    if (client) client->stop();
+    client = nullptr;
+    sampleHeap();
+}
+
+// the pieces of a request are collected in the head buffer, so it doesn't go out in a segment each
+void Http::send(const char *const text) {
+    send((const uint8_t *)text, strlen(text));
+}
+void Http::send(const uint8_t *const data, const size_t size) {
+    if (head_length + size > sizeof(head) && !flush()) send_failed = true;
+    if (size > sizeof(head)) {
+        if (client->write(data, size) != size) send_failed = true;
+        return;
+    }
+    memcpy(head + head_length, data, size);
+    head_length += size;
+}
+bool Http::flush() {
+    const size_t length = head_length;
+    head_length = 0;
+    return client->write(head, length) == length;
+}
+
+uint16_t Http::request(const char *const method, const uint8_t *const body, const size_t size) {
+    if (!client) return 0;
+    char number[11];
+    head_length = 0;
+    send_failed = false;
+
+    send(method);
+    send(" ");
+    send(path);
+    send(" HTTP/1.1\r\nHost: ");
+    send(host);
+    if (port != 80) {
+        send(":");
+        send(utoa(port, number, 10));
+    }
+    send("\r\nConnection: close\r\n");
+    for (uint8_t i = 0; i < header_count; i += 1) {
+        send(header_names[i]);
+        send(": ");
+        send(header_values[i]);
+        send("\r\n");
+    }
+    if (body) {
+        send("Content-Type: application/octet-stream\r\nContent-Length: ");
+        send(utoa(size, number, 10));
+        send("\r\n");
+    }
+    send("\r\n");
+    if (body) send(body, size);
+    if (!flush() || send_failed) return 0;
+
+    // HTTP/1.x 200 OK
+    if (!readLine() || strncmp(line, "HTTP/1.", 7) || line[8] != ' ') return 0;
+    const uint16_t status = atoi(line + 9);
+
+    content_length = -1;
+    while (true) {
+        if (!readLine()) return 0;
+        if (line[0] == 0) break;
+        if (!strncasecmp(line, "Content-Length:", 15)) content_length = atol(line + 15);
+        // download() reads the body raw
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            const char *value = line + 18;
+            while (*value == ' ') value += 1;
+            if (!strncasecmp(value, "chunked", 7)) return 0;
+        }
+    }
+
+    sampleHeap();
+    return status;
+}
+
+// reads a line without its line break into the line buffer
+bool Http::readLine() {
+    size_t length = 0;
+    uint8_t byte;
+    while (true) {
+        if (client->readBytes(&byte, 1) != 1) return false;
+        if (byte == '\n') break;
+        if (byte != '\r' && length + 1 < sizeof(line)) line[length++] = byte;
+    }
+    line[length] = 0;
+    return true;
+}
+
+void sampleHeap() {
+    const uint32_t free_heap = ESP.getFreeHeap();
+    const uint8_t fragmentation = ESP.getHeapFragmentation();
+    if (free_heap < min_free_heap) min_free_heap = free_heap;
+    if (fragmentation > max_fragmentation) max_fragmentation = fragmentation;
+}
+tuple<uint32_t, uint8_t> heapWatermarks() {
+    return tuple(min_free_heap == UINT32_MAX ? 0 : min_free_heap, max_fragmentation);
+}
@@ -0,0 +1,49 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <WiFiClient.h>
+#include <cstdint>
+#include <tuple>
+
+const uint16_t HTTP_TIMEOUT = 2000; // ms for the status line and every header
+const uint8_t HTTP_HOST_SIZE = 64;
+const uint8_t HTTP_LINE_SIZE = 128; // longer header lines are cut, only their start is parsed
+const uint8_t HTTP_MAX_HEADERS = 6;
+const uint16_t HTTP_HEAD_SIZE = 512; // the request goes out in one write up to this size, a small body included
+
+// http/1.1 without heap allocations, the buffers are static, so only one request can be open at a time
+class Http {
+    public:
+        // false if the url isn't plain http or the connection fails
+        bool begin(WiFiClient *const client, const char *const url);
+        // sent with the request, the strings must live until then; false once HTTP_MAX_HEADERS are set
+        bool header(const char *const name, const char *const value);
+        // status code, 0 if the response can't be parsed
+        uint16_t get();
+        uint16_t post(const uint8_t *const body, const size_t size);
+        // positioned at the first byte of the body, the server closes the connection after the last one
+        WiFiClient *getStreamPtr();
+        int32_t contentLength(); // -1 if the server didn't send it
+        void end();
+    private:
+        WiFiClient *client = nullptr;
+        const char *path = nullptr;
+        uint16_t port = 80;
+        int32_t content_length = -1;
+        const char *header_names[HTTP_MAX_HEADERS];
+        const char *header_values[HTTP_MAX_HEADERS];
+        uint8_t header_count = 0;
+
+        uint16_t request(const char *const method, const uint8_t *const body, const size_t size);
+        void send(const char *const text);
+        void send(const uint8_t *const data, const size_t size);
+        bool flush();
+        bool readLine();
+};
+
+// samples the heap, the http client calls it at its peaks
+void sampleHeap();
+// min_free_heap, max_fragmentation (%) since boot, 0, 0 without a sample
+std::tuple<uint32_t, uint8_t> heapWatermarks();
+
+#endif // !HTTP_H
@@ -1,65 +1,86 @@
 #include "storage.h"
 #include "epd.h"
 #include "server_access.h"
+#include "deadline.h"
 #include <Arduino.h>
 #include <SD.h>
+#include <LittleFS.h>
 #include <EEPROM.h>
 #include <tuple>
 
 using namespace std;
 
-void tryReportErrors(const FullResult *const errors, uint8_t *const error_count) {
+void saveErrors(const FullResult *const errors, const uint8_t error_count) {
+    uint8_t old_error_count = EEPROM.read(ERROR_COUNT_ADDRESS);
+    if (old_error_count == 255) old_error_count = 0;
+    for (uint8_t i = old_error_count; i < error_count; i += 1) EEPROM.write(i, errors[i].value);
+}
+void tryReportErrors(const FullResult *const errors, uint8_t *const error_count, const BatteryLevel battery_level) {
     if (!*error_count) return;
+    // a weak battery saves the radio time until the buffer fills up
+    if ((battery_level == BatteryLevel::Weak && *error_count < ERROR_BUFFER_SIZE / 2) || deadlineExceeded()) { saveErrors(errors, *error_count); return; }
     const ReportResult result = reportErrors(errors, *error_count);
     if (result == ReportResult::Ok) *error_count = 0;
     else {
-        uint8_t old_error_count = EEPROM.read(ERROR_COUNT_ADDRESS);
-        if (old_error_count == 255) old_error_count = 0;
-        for (uint8_t i = old_error_count; i < *error_count; i += 1) EEPROM.write(i, errors[i].value);
+        saveErrors(errors, *error_count);
         writeError(error_count, Type::DayGeneric, (Result)result);
     }
 }
 
-// days_until_recent_check
-uint8_t checkRecent(FullResult *const errors, uint8_t *const error_count, uint8_t days_until_recent_check) {
-    if (days_until_recent_check != 0) return days_until_recent_check;
+// days_until_recent_check, recent_displayed, rand_files_removed
+tuple<uint8_t, bool, bool> checkRecent(FullResult *const errors, uint8_t *const error_count, uint8_t days_until_recent_check, const bool display) {
+    if (days_until_recent_check != 0) return tuple(days_until_recent_check, false, false);
 
-    const auto [result, days_until_current_check_new] = saveRecent();
+    const SaveResult palette_result = savePalette();
+    if (palette_result != SaveResult::Ok) writeError(errors, error_count, display ? Type::NightGeneric : Type::DayGeneric, (Result)palette_result);
+    const auto [result, days_until_current_check_new, displayed, tiles_replaced] = saveRecent(display);
     if (days_until_current_check_new != 0 && days_until_current_check_new <= DAYS_UNTIL_RECENT_CHECK_WARNING)
         days_until_recent_check = days_until_current_check_new;
     else if (result != SaveResult::LimitExceded) writeError(errors, error_count, Type::DayRecent, Result::LimitExceded);
-    if (result != SaveResult::Ok) writeError(errors, error_count, Type::DayRecent, (Result)result);
-
-    return days_until_recent_check;
+    if (result != SaveResult::Ok) writeError(errors, error_count, display ? Type::NightRecent : Type::DayRecent, (Result)result);
+
+    // the random images can't be drawn from a replaced tile dictionary, the next batch comes right away
+    if (tiles_replaced) {
+        const auto [count_success, rand_file_count] = randFileCount();
+        if (!count_success) writeError(errors, error_count, Type::DayGeneric, Result::FilesMissing);
+        const RandFilesResult shift_result = shiftFiles(rand_file_count, rand_file_count);
+        if (shift_result != RandFilesResult::Ok) writeError(errors, error_count, Type::DayRand, (Result)shift_result);
+    }
+    return tuple(days_until_recent_check, displayed, tiles_replaced);
 }
 // min_file_count, rand_files_shifted
-tuple<uint8_t, bool> checkRand(FullResult *const errors, uint8_t *const error_count, uint8_t min_file_count, uint8_t images_read) {
+tuple<uint8_t, bool> checkRand(FullResult *const errors, uint8_t *const error_count, uint8_t min_file_count, uint8_t images_read, const BatteryLevel battery_level) {
     auto [count_success, rand_file_count] = randFileCount();
     if (!count_success) writeError(errors, error_count, Type::DayGeneric, Result::FilesMissing);
-    if (rand_file_count - images_read >= min_file_count) return tuple(min_file_count, false);
+    // the lower the battery, the fewer unseen images are left when a refill starts, reusing already displayed images
+    // meanwhile, the batch is as long as the server sends
+    if (rand_file_count - images_read >= (min_file_count >> (uint8_t)battery_level)) return tuple(min_file_count, false);
 
     bool rand_files_shifted = false;
-    const auto [result, images, min_file_count_new] = saveRand(rand_file_count);
+    const auto [result, images, min_file_count_new, tiles_replaced] = saveRand(rand_file_count);
     if (min_file_count_new != 0 && min_file_count_new <= MIN_FILE_COUNT_WARNING) min_file_count = min_file_count_new;
     else if (result != SaveResult::LimitExceded) writeError(errors, error_count, Type::DayRand, Result::LimitExceded);
-    if (result == SaveResult::Ok) {
-        RandFilesResult result = shiftFiles(rand_file_count + images, images_read);
+    // the images saved before the deadline are used as a smaller batch, a new tile dictionary replaces the older images
+    // even when the batch failed, they can't be drawn from it
+    if (result == SaveResult::Ok || (result == SaveResult::DeadlineExceeded && images) || tiles_replaced) {
+        RandFilesResult result = shiftFiles(rand_file_count + images, tiles_replaced ? rand_file_count : images_read);
         if (result != RandFilesResult::Ok) writeError(errors, error_count, Type::DayRand, (Result)result);
         rand_files_shifted = true;
-    } else writeError(errors, error_count, Type::DayRand, (Result)result);
+    }
+    if (result != SaveResult::Ok) writeError(errors, error_count, Type::DayRand, (Result)result);
     return tuple(min_file_count, rand_files_shifted);
 }
 // days_until_battery_check, terminate
-tuple<uint8_t, bool> checkBattery(FullResult *const errors, uint8_t *const error_count, uint8_t days_until_battery_check) {
+tuple<uint8_t, bool> checkBattery(FullResult *const errors, uint8_t *const error_count, uint8_t days_until_battery_check, const uint16_t charge, const int32_t clock_offset) {
     if (days_until_battery_check != 0) return tuple(days_until_battery_check, false);
 
     uint8_t terminate = false;
-    const uint16_t charge = analogRead(A0);
-    const ReportResult battery_result = reportBattery(charge);
+    const ReportResult battery_result = reportBattery(charge, clock_offset);
     if (battery_result == ReportResult::Ok) {
         days_until_battery_check = DAYS_UNTIL_BATTERY_CHECK;
         if (charge < BATTERY_CHARGE_WARNING) {
-            clearEpd();
+            const DisplayResult clear_result = clearEpd();
+            if (clear_result != DisplayResult::Ok) writeError(errors, error_count, Type::DayGeneric, (Result)clear_result);
             terminate = true;
         }
     } else writeError(errors, error_count, Type::DayGeneric, (Result)battery_result);
@@ -68,7 +89,7 @@ tuple<uint8_t, bool> checkBattery(FullResult *const errors, uint8_t *const error
 
 uint8_t readHour(uint8_t *const error_count) {
     uint32_t saved_hour;
-    if (!ESP.rtcUserMemoryRead(0, &saved_hour, 1)) { writeError(error_count, Type::Generic, Result::RtcReadFailed); return 255; }
+    if (!ESP.rtcUserMemoryRead(RTC_HOUR_BLOCK, &saved_hour, sizeof(saved_hour))) { writeError(error_count, Type::Generic, Result::RtcReadFailed); return 255; }
     const uint8_t hour = saved_hour & 0xff;
     if (hour != saved_hour >> 8) { writeError(error_count, Type::Generic, Result::TimeLost); return 255; }
     if (hour > 24) {
@@ -78,14 +99,26 @@ uint8_t readHour(uint8_t *const error_count) {
     return hour;
 }
 
-void sleep(uint8_t error_count, uint8_t hour, const bool terminate = analogRead(A0) < BATTERY_CHARGE_ERROR) {
-    if (hour < 24) {
-        hour += 3;
-        if (hour >= 24) hour -= 24;
-    }
-    if (terminate) hour = 255;
+// the wakes out of the night and day windows only move the hour on, and so do the wakes after the first of a window
+bool idleHour(const uint8_t hour) {
+    return hour < 24 && hour % 12 >= WAKE_INTERVAL;
+}
+uint8_t nextHour(uint8_t hour) {
+    if (hour >= 24) return hour;
+    hour += WAKE_INTERVAL;
+    return hour >= 24 ? hour - 24 : hour;
+}
+bool writeHour(const uint8_t hour) {
     uint32_t saved_hour = ((uint16_t)hour << 8) | hour;
-    if (!ESP.rtcUserMemoryWrite(0, &saved_hour, 1)) writeError(&error_count, Type::Generic, Result::RtcWriteFailed);
+    return ESP.rtcUserMemoryWrite(RTC_HOUR_BLOCK, &saved_hour, sizeof(saved_hour));
+}
+
+// hour_start is the millis() value when the current hour started, 0 if unknown
+void sleep(uint8_t error_count, uint8_t hour, const bool terminate = analogRead(A0) < BATTERY_CHARGE_ERROR, const int32_t hour_start = 0) {
+    hour = terminate ? 255 : nextHour(hour);
+    saveSdStats(&error_count);
+    saveHeapStats(&error_count);
+    if (!writeHour(hour)) writeError(&error_count, Type::Generic, Result::RtcWriteFailed);
 
     if (error_count != EEPROM.read(ERROR_COUNT_ADDRESS)) {
         EEPROM.write(ERROR_COUNT_ADDRESS, error_count);
@@ -94,37 +127,67 @@ void sleep(uint8_t error_count, uint8_t hour, const bool terminate = analogRead(
     //Serial.println("sleep");
     //for (uint8_t i = 0; i < 18; i += 1) Serial.println(EEPROM.read(i)); // TODO: remove
     EEPROM.end();
+    // the eeprom commit ran while the panel refreshed
+    Epd::finishRefresh();
 
     if (terminate) ESP.deepSleep(0);
-    ESP.deepSleep(10800e6 - micros()); // 3 hours
+    // a sync late in its hour can run past the next wake, 0 would sleep for good
+    const int64_t sleep_us = WAKE_INTERVAL * 3600000000LL - ((int64_t)micros() - (int64_t)hour_start * 1000);
+    ESP.deepSleep(std::max<int64_t>(sleep_us, 1));
 }
 void tryReprotSd(uint8_t error_count) {
     if (error_count == 255) sleep(error_count, 255); // reported
 
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(SSID, PSW);
+    beginWifi();
     if (!EEPROM.read(EPD_CLEARED_ADDRESS)) {
         writeError(&error_count, Type::Generic, Result::SdNotConnected);
-        clearEpd();
+        const DisplayResult clear_result = clearEpd();
+        if (clear_result != DisplayResult::Ok) writeError(&error_count, Type::Generic, (Result)clear_result);
     }
 
-    if (WiFi.waitForConnectResult() != WL_CONNECTED) {
+    if (WiFi.waitForConnectResult(std::min(remainingTime(), CONNECT_TIMEOUT)) != WL_CONNECTED) {
+        recordLink(&error_count, 0, false);
         disconnectWifi();
         sleep(error_count, 255);
     }
+    recordLink(&error_count, WiFi.RSSI(), true);
 
     FullResult errors[ERROR_BUFFER_SIZE];
 
     for (uint8_t i = 0; i < error_count; i += 1) errors[i] = (FullResult)EEPROM.read(i);
 
-    tryReportErrors(errors, &error_count);
+    tryReportErrors(errors, &error_count, BatteryLevel::Full);
     disconnectWifi();
 
     if (!error_count) error_count = 255;
     sleep(error_count, 255);
 }
 
+// an idle wake is decided from the rtc memory alone, it leaves the eeprom, the sd card and the panel pins untouched;
+// anything unusual, a low battery or a failed rtc write included, takes the full path, which reports it
+void fastSleep() {
+    uint32_t saved_hour;
+    if (!ESP.rtcUserMemoryRead(RTC_HOUR_BLOCK, &saved_hour, sizeof(saved_hour))) return;
+    const uint8_t hour = saved_hour & 0xff;
+    if (hour != saved_hour >> 8 || !idleHour(hour)) return;
+    if (analogRead(A0) < BATTERY_CHARGE_ERROR) return;
+
+    // the stats go first, a failed hour write leaves the wake to the full path with the hour it found
+    WakeStats stats;
+    if (!readRtc(RTC_WAKE_BLOCK, &stats)) stats = {};
+    const uint16_t awake_us = min(micros(), (unsigned long)UINT16_MAX);
+    if (stats.count < UINT16_MAX) {
+        stats.count += 1;
+        stats.total_us += awake_us;
+        stats.max_us = max(stats.max_us, awake_us);
+    }
+    writeRtc(RTC_WAKE_BLOCK, &stats);
+    if (!writeHour(nextHour(hour))) return;
+    ESP.deepSleep(WAKE_INTERVAL * 3600e6 - (int64_t)micros());
+}
+
 void setup() {
+    fastSleep();
     // TODO: remove
     //Serial.begin(9600);
     //while (!Serial);
@@ -141,18 +204,37 @@ void setup() {
     uint8_t hour = readHour(&error_count);
     //Serial.println(hour);
     if (error_count == 255) hour = 255;
-    if ((hour > 2 && hour < 12) || (hour > 14 && hour < 24)) sleep(error_count, hour);
+    if (idleHour(hour)) sleep(error_count, hour);
+    beginPhase(hour == 255 ? WakeType::Recovery : hour <= 2 ? WakeType::NightRender : WakeType::DaySync);
+
+    // the average picks the sync policy, the safety cut-offs act on the sample itself
+    const auto [charge, sample] = sampleBattery(&error_count);
+    const BatteryLevel battery_level = batteryLevel(charge);
 
     // read //
 
     if (hour == 255 || (hour >= 12 && hour <= 14)) {
-        WiFi.mode(WIFI_STA);
-        WiFi.begin(SSID, PSW);
+        beginWifi();
     }
 
-    if (!SD.begin(SD_CS)) {
-        disconnectWifi();
-        tryReprotSd(error_count);
+    // the state is kept in the flash, the copy on the sd card is a fallback
+    const bool flash_mounted = LittleFS.begin();
+    if (!flash_mounted) writeError(&error_count, Type::Generic, Result::FlashMountFailed);
+    State state;
+    Result state_result = flash_mounted ? readState(LittleFS.open(FLASH_STATE_FILE, "r"), &state) : Result::ReadOpenFailed;
+
+    // a night without a sync renders the cached frame and leaves the sd card alone
+    const bool cached = hour <= 2 && state_result == Result::Ok && state.failed_wifi_connections < MAX_FAILED_WIFI_CONNECTIONS && LittleFS.exists(FRAME_FILE);
+    bool sd_mounted = false;
+    if (!cached) {
+        if (!SD.begin(SD_CS)) {
+            disconnectWifi();
+            if (flash_mounted) LittleFS.end();
+            tryReprotSd(error_count);
+        }
+        sd_mounted = true;
+        yield();
+        if (state_result != Result::Ok) state_result = readState(sdOpen(STATE_FILE), &state);
     }
 
     uint8_t next_image = 0;
@@ -161,64 +243,59 @@ void setup() {
     uint8_t days_until_battery_check = 0;
 
     uint8_t failed_wifi_connections = 0;
-    uint8_t min_file_count = 30;
+    uint8_t min_file_count = DEFAULT_MIN_FILE_COUNT;
 
-    yield();
-    File state = SD.open(STATE_FILE);
-    if (!state) writeError(&error_count, Type::Generic, Result::ReadOpenFailed);
-    else if (state.available() != 6) { state.close(); writeError(&error_count, Type::Generic, Result::WrongLength); }
+    if (state_result != Result::Ok) writeError(&error_count, Type::Generic, state_result);
     else {
-        next_image = state.read();
-        images_read = state.read();
+        next_image = state.next_image;
+        images_read = state.images_read;
 
-        days_until_recent_check = state.read();
+        days_until_recent_check = state.days_until_recent_check;
         if (days_until_recent_check > DAYS_UNTIL_RECENT_CHECK_WARNING) {
             writeError(&error_count, Type::Generic, Result::LimitExceded);
             days_until_recent_check = 0;
         }
-        days_until_battery_check = state.read();
+        days_until_battery_check = state.days_until_battery_check;
         if (days_until_battery_check > DAYS_UNTIL_BATTERY_CHECK) {
             writeError(&error_count, Type::Generic, Result::LimitExceded);
             days_until_battery_check = 0;
         }
-        failed_wifi_connections = state.read();
+        failed_wifi_connections = state.failed_wifi_connections;
         if (failed_wifi_connections > MAX_FAILED_WIFI_CONNECTIONS) {
             writeError(&error_count, Type::Generic, Result::LimitExceded);
             failed_wifi_connections = MAX_FAILED_WIFI_CONNECTIONS;
         }
-        min_file_count = state.read();
+        min_file_count = state.min_file_count;
         if (min_file_count == 0 || min_file_count > MIN_FILE_COUNT_WARNING) {
             writeError(&error_count, Type::Generic, Result::LimitExceded);
             min_file_count = DEFAULT_MIN_FILE_COUNT;
         }
-        state.close();
     }
 
     if (failed_wifi_connections > MAX_FAILED_WIFI_CONNECTIONS) {
-        WiFi.mode(WIFI_STA);
-        WiFi.begin(SSID, PSW);
+        beginWifi();
     }
+    if (hour <= 2 && failed_wifi_connections == MAX_FAILED_WIFI_CONNECTIONS) beginPhase(WakeType::DaySync);
 
     // connect //
 
     bool terminate = false;
+    bool recent_displayed = false;
+    NtpTime ntp_time;
 
     if (hour == 255) {
-        if (WiFi.waitForConnectResult() == WL_CONNECTED) {
-            if ((hour = getNtpHour()) < 24) goto connected;
-            else writeError(&error_count, Type::Generic, Result::NtpUpdateFailed);
-        }
+        if (WiFi.waitForConnectResult(std::min(remainingTime(), CONNECT_TIMEOUT)) == WL_CONNECTED) goto connected;
+        recordLink(&error_count, 0, false);
         disconnectWifi();
-        clearEpd();
+        beginPhase(WakeType::NightRender);
+        const DisplayResult clear_result = clearEpd();
+        if (clear_result != DisplayResult::Ok) writeError(&error_count, Type::Generic, (Result)clear_result);
         SD.end();
+        if (flash_mounted) LittleFS.end();
         sleep(error_count, 255);
     } else if ((hour >= 12 && hour <= 14) || failed_wifi_connections == MAX_FAILED_WIFI_CONNECTIONS) {
-        if (WiFi.waitForConnectResult() == WL_CONNECTED) {
-            const uint8_t new_hour = getNtpHour();
-            if (new_hour < 24) hour = new_hour;
-            else writeError(&error_count, Type::DayGeneric, Result::NtpUpdateFailed);
-            goto connected;
-        }
+        if (WiFi.waitForConnectResult(std::min(remainingTime(), CONNECT_TIMEOUT)) == WL_CONNECTED) goto connected;
+        recordLink(&error_count, 0, false);
         disconnectWifi();
         if (failed_wifi_connections < MAX_FAILED_WIFI_CONNECTIONS) {
             failed_wifi_connections += 1;
@@ -230,56 +307,100 @@ void setup() {
 
     if (false) {
         connected: 
+        beginNtp();
+        failed_wifi_connections = 0;
+        const int8_t rssi = WiFi.RSSI();
 
         FullResult errors[ERROR_BUFFER_SIZE];
         for (uint8_t i = 0; i < error_count; i += 1) errors[i] = (FullResult)EEPROM.read(i);
 
-        days_until_recent_check = checkRecent(errors, &error_count, days_until_recent_check);
-        bool rand_files_shifted;
-        tie(min_file_count, rand_files_shifted) = checkRand(errors, &error_count, min_file_count, images_read);
-        if (rand_files_shifted) {
+        // a recovery or a retried sync may fall into the render window, then the recent image goes straight to the panel
+        const bool early_ntp = hour == 255 || hour <= 2;
+        if (early_ntp) ntp_time = waitNtp(hour);
+
+        bool rand_files_removed, rand_files_shifted = false;
+        tie(days_until_recent_check, recent_displayed, rand_files_removed) = checkRecent(errors, &error_count, days_until_recent_check, ntp_time.hour <= 2);
+        if (rand_files_removed) images_read = 0;
+        if (!deadlineExceeded()) tie(min_file_count, rand_files_shifted) = checkRand(errors, &error_count, min_file_count, images_read, battery_level);
+        if (rand_files_removed || rand_files_shifted) {
             images_read = 0;
             next_image = 0;
+            // the cached frame may show a file that moved
+            if (flash_mounted) LittleFS.remove(FRAME_FILE);
         }
 
-        tie(days_until_battery_check, terminate) = checkBattery(errors, &error_count, days_until_battery_check);
+        if (!early_ntp) ntp_time = waitNtp(hour);
+        if (ntp_time.hour < 24) hour = ntp_time.hour;
+        else writeError(errors, &error_count, hour == 255 ? Type::Generic : Type::DayGeneric, Result::NtpUpdateFailed);
+
+        if (!deadlineExceeded()) tie(days_until_battery_check, terminate) = checkBattery(errors, &error_count, days_until_battery_check, sample, ntp_time.offset);
+        else writeError(errors, &error_count, Type::DayGeneric, Result::DeadlineExceeded);
 
-        tryReportErrors(errors, &error_count);
+        // the errors stay in the eeprom once the deadline has passed
+        tryReportErrors(errors, &error_count, battery_level);
+        recordLink(&error_count, rssi, transferHealthy());
         disconnectWifi();
+        // the panel gets its own phase, so a late sync doesn't leave the night without a refresh
+        if (hour == 255 || (hour <= 2 && !recent_displayed)) beginPhase(WakeType::NightRender);
+        if (hour == 255) {
+            const DisplayResult clear_result = clearEpd();
+            if (clear_result != DisplayResult::Ok) writeError(&error_count, Type::Generic, (Result)clear_result);
+        }
     }
     
     if (hour <= 2) {
-        const auto [rand_file_count, new_next_image, rollover] = night(next_image, &error_count);
-        next_image = new_next_image;
-        images_read = rollover ? rand_file_count : std::max(images_read, next_image);
+        if (recent_displayed) {
+            if (EEPROM.read(EPD_CLEARED_ADDRESS)) EEPROM.write(EPD_CLEARED_ADDRESS, 0);
+        } else {
+            bool frame_displayed = false;
+            uint8_t rand_file_count, new_next_image;
+            bool rollover;
+            // the day wake may have moved tonight's recent image into the frame, so it is used even when the sd card is mounted
+            if (flash_mounted) tie(frame_displayed, rand_file_count, new_next_image, rollover) = nightFrame(next_image, days_until_recent_check, &error_count);
+            if (!frame_displayed) {
+                if (!sd_mounted) {
+                    if (!SD.begin(SD_CS)) {
+                        LittleFS.end();
+                        tryReprotSd(error_count);
+                    }
+                    sd_mounted = true;
+                }
+                tie(rand_file_count, new_next_image, rollover) = night(next_image, days_until_recent_check, &error_count);
+            }
+            next_image = new_next_image;
+            images_read = rollover ? rand_file_count : std::max(images_read, next_image);
+        }
         if (days_until_recent_check != 0) days_until_recent_check -= 1;
 
         if (days_until_battery_check != 0) days_until_battery_check -= 1;
-        const uint16_t charge = analogRead(A0);
-        if (charge < BATTERY_CHARGE_ERROR) terminate = true;
-        else if (charge < BATTERY_CHARGE_WARNING) days_until_battery_check = 0;
+        if (sample < BATTERY_CHARGE_ERROR) terminate = true;
+        else if (sample < BATTERY_CHARGE_WARNING) days_until_battery_check = 0;
     }
 
-    // write back //
-
-    yield();
-    if ((state = SD.open(STATE_FILE, FILE_WRITE))) {
-        if (!state.truncate(0)) writeError(&error_count, Type::Generic, Result::ClearFailed);
-
-        if (!state.write(next_image)) goto write_end;
-        if (!state.write(images_read)) goto write_end;
-        if (!state.write(days_until_recent_check)) goto write_end;
-        if (!state.write(days_until_battery_check)) goto write_end;
-        if (!state.write(failed_wifi_connections)) goto write_end;
-        if (!state.write(min_file_count)) goto write_end;
-
-        if (false) { write_end: writeError(&error_count, Type::Generic, Result::WriteFailed); }
+    // the day wake renders the next night's image into the flash
+    if (hour >= 12 && hour <= 14 && flash_mounted && sd_mounted) cacheFrame(next_image, days_until_recent_check, &error_count);
 
-        state.close();
-    } else writeError(&error_count, Type::Generic, Result::WriteOpenFailed);
+    // write back //
 
-    SD.end();
-    sleep(error_count, hour, terminate);
+    state = { next_image, images_read, days_until_recent_check, days_until_battery_check, failed_wifi_connections, min_file_count };
+    bool flash_written = false;
+    if (flash_mounted) {
+        yield();
+        const Result result = writeState(LittleFS.open(FLASH_STATE_FILE, "w"), &state);
+        if (result != Result::Ok) writeError(&error_count, Type::Generic, result);
+        else flash_written = true;
+    }
+    // the sd copy is only a fallback for the flash state, a slow card keeps the old one
+    if (sd_mounted && (!flash_written || !sdSlow())) {
+        yield();
+        const Result result = writeState(sdOpen(STATE_FILE, FILE_WRITE), &state);
+        if (result != Result::Ok) writeError(&error_count, Type::Generic, result);
+    }
+    // SD.end() releases the spi bus, the panel gets its last commands before
+    Epd::finishRefresh();
+    if (flash_mounted) LittleFS.end();
+    if (sd_mounted) SD.end();
+    sleep(error_count, hour, terminate, ntp_time.hour < 24 ? ntp_time.hour_start + WAKE_MARGIN : 0);
 }
 
 void loop() {}
@@ -1,5 +1,4 @@
 // wifi: https://arduino-esp8266.readthedocs.io/en/latest/esp8266wifi/readme.html
-// http: https://github.com/esp8266/Arduino/blob/master/libraries/ESP8266HTTPClient/examples/StreamHttpClient/StreamHttpClient.ino
 
 #include "server_access.h"
 #include "epd.h"
@@ -7,25 +6,129 @@
 #include <SPI.h>
 #include <SD.h>
 #include <tuple>
-#include <NTPClient.h>
-#include <WiFiUdp.h>
+#include <sys/time.h>
 //#include <wl_definitions.h>
 //#include "ESP8266WiFiGeneric.h"
 
 using namespace std;
 
+static uint32_t transfer_bytes = 0;
+static uint32_t transfer_us = 0; // reading the stream only, the sd card writes aren't the link's
+static bool transfer_failed = false;
+// a download started a new tile dictionary, the tiled images saved before can't be displayed anymore
+static bool tiles_replaced = false;
+// bytes of the image response not read yet by its content length, -1 if unknown
+static int32_t body_left = -1;
+
+// false if the body can't hold the next size bytes, so a truncated response writes nothing to the sd card
+static bool takeBody(const uint32_t size) {
+    if (body_left < 0) return true;
+    if (size > (uint32_t)body_left) return false;
+    body_left -= size;
+    return true;
+}
+
+bool readLink(LinkHistory *const link) {
+    if (readRtc(RTC_LINK_BLOCK, link) && link->next < LINK_HISTORY_SIZE && link->count <= LINK_HISTORY_SIZE
+        && link->level < LINK_LEVEL_COUNT) return true;
+    memset(link, 0, sizeof(*link));
+    link->level = DEFAULT_LINK_LEVEL;
+    return false;
+}
+
+void beginWifi() {
+    LinkHistory link;
+    readLink(&link);
+    WiFi.mode(WIFI_STA);
+    WiFi.setPhyMode(LINK_SETTINGS[link.level].phy_mode);
+    WiFi.setOutputPower(LINK_SETTINGS[link.level].tx_power);
+    WiFi.begin(SSID, PSW);
+}
+void recordLink(uint8_t *const error_count, const int8_t rssi, const bool healthy) {
+    LinkHistory link;
+    readLink(&link);
+    // an unknown rssi leaves the samples alone and the level to the transfers
+    const bool known = rssi != 0 && rssi != RSSI_UNKNOWN;
+    if (known) {
+        link.rssi[link.next] = rssi;
+        link.next = (link.next + 1) % LINK_HISTORY_SIZE;
+        if (link.count < LINK_HISTORY_SIZE) link.count += 1;
+    }
+
+    bool strong = link.count >= 3;
+    for (uint8_t i = 0; i < link.count; i += 1) if (link.rssi[i] < RSSI_STRONG) strong = false;
+    if (!healthy || rssi == 0 || (known && rssi < RSSI_WEAK)) {
+        if (link.level > 0) link.level -= 1;
+        // the samples taken with more power would lower it again right away
+        link.count = 0;
+        link.next = 0;
+    } else if (strong && link.level + 1 < LINK_LEVEL_COUNT) {
+        link.level += 1;
+        link.count = 0;
+        link.next = 0;
+    }
+    if (!writeRtc(RTC_LINK_BLOCK, &link)) writeError(error_count, Type::Generic, Result::RtcWriteFailed);
+}
+bool transferHealthy() {
+    if (transfer_failed) return false;
+    return transfer_us < 1000000 || (uint64_t)transfer_bytes * 1000000 / transfer_us >= MIN_TRANSFER_RATE;
+}
+
 void disconnectWifi() {
     WiFi.disconnect();
     WiFi.mode(WIFI_OFF);
 }
 
-ReportResult reportBattery(const uint8_t charge) {
+// the earlier wakes merged with this one
+static HeapStats heapStats() {
+    HeapStats stats;
+    if (!readRtc(RTC_HEAP_BLOCK, &stats)) stats = { UINT16_MAX, 0, 0 };
+    const auto [min_free_heap, max_fragmentation] = heapWatermarks();
+    if (!min_free_heap) return stats;
+    stats.min_free_heap = min(stats.min_free_heap, (uint16_t)min(min_free_heap, (uint32_t)UINT16_MAX));
+    stats.max_fragmentation = max(stats.max_fragmentation, max_fragmentation);
+    return stats;
+}
+void saveHeapStats(uint8_t *const error_count) {
+    if (!get<0>(heapWatermarks())) return; // no request this wake
+    const HeapStats stats = heapStats();
+    if (!writeRtc(RTC_HEAP_BLOCK, &stats)) writeError(error_count, Type::Generic, Result::RtcWriteFailed);
+}
+
+ReportResult reportBattery(const uint16_t charge, const int32_t clock_offset) {
     WiFiClient wifi;
-    HTTPClient http;
+    Http http;
 
-    if (!http.begin(wifi, REPORT)) return ReportResult::HttpBeginFailed;
-    const uint8_t message[3] = { 255, (uint8_t)(charge & 0x00ff), (uint8_t)(charge >> 8) };
-    const ReportResult result = http.POST(message, sizeof(message)) == 200 ? ReportResult::Ok : ReportResult::HttpRequestFailed;
+    if (!http.begin(&wifi, REPORT)) return ReportResult::HttpBeginFailed;
+    // the heap watermarks of the week ride along, so a leak shows up in the report
+    const HeapStats heap_stats = heapStats();
+    const uint16_t heap = heap_stats.min_free_heap;
+    const uint8_t max_fragmentation = heap_stats.max_fragmentation;
+    // and so do the idle wakes, they are most of the wakes
+    WakeStats wakes;
+    if (!readRtc(RTC_WAKE_BLOCK, &wakes)) wakes = {};
+    const uint16_t mean_us = wakes.count ? wakes.total_us / wakes.count : 0;
+    uint8_t message[19] = {
+        255, (uint8_t)(charge & 0x00ff), (uint8_t)(charge >> 8),
+        254, (uint8_t)(heap & 0x00ff), (uint8_t)(heap >> 8), max_fragmentation,
+        252, (uint8_t)(wakes.count & 0x00ff), (uint8_t)(wakes.count >> 8), (uint8_t)(mean_us & 0x00ff), (uint8_t)(mean_us >> 8),
+        (uint8_t)(wakes.max_us & 0x00ff), (uint8_t)(wakes.max_us >> 8),
+    };
+    uint8_t size = 14;
+    // the drift of the rtc over the last sleep, the wake schedule leans on it
+    if (clock_offset != NO_CLOCK_OFFSET) {
+        message[size++] = 251;
+        for (uint8_t i = 0; i < 4; i += 1) message[size++] = (uint32_t)clock_offset >> (8 * i);
+    }
+    const ReportResult result = http.post(message, size) == 200 ? ReportResult::Ok : ReportResult::HttpRequestFailed;
+    // a failed write counts the reported wakes again in the next report; the heap of this wake is merged again
+    // when it sleeps, the watermarks don't mind
+    if (result == ReportResult::Ok) {
+        wakes = {};
+        writeRtc(RTC_WAKE_BLOCK, &wakes);
+        const HeapStats heap_stats = { UINT16_MAX, 0, 0 };
+        writeRtc(RTC_HEAP_BLOCK, &heap_stats);
+    }
 
     http.end();
     return result;
@@ -33,21 +136,53 @@ ReportResult reportBattery(const uint8_t charge) {
 
 ReportResult reportErrors(const FullResult *const errors, const uint8_t error_count) {
     WiFiClient wifi;
-    HTTPClient http;
+    Http http;
 
-    if (!http.begin(wifi, REPORT)) return ReportResult::HttpBeginFailed;
-    const ReportResult result = http.POST((uint8_t *)errors, error_count) == 200 ? ReportResult::Ok : ReportResult::HttpRequestFailed;
+    if (!http.begin(&wifi, REPORT)) return ReportResult::HttpBeginFailed;
+    // the sd card latency histograms follow the errors
+    const SdStats *const stats = sdStats();
+    uint8_t message[ERROR_BUFFER_SIZE + 1 + sizeof(stats->histogram)];
+    memcpy(message, errors, error_count);
+    uint8_t size = error_count;
+    message[size++] = 253;
+    for (uint8_t operation = 0; operation < SD_OPERATION_COUNT; operation += 1) {
+        for (uint8_t bucket = 0; bucket < SD_LATENCY_BUCKET_COUNT; bucket += 1) {
+            message[size++] = stats->histogram[operation][bucket] & 0x00ff;
+            message[size++] = stats->histogram[operation][bucket] >> 8;
+        }
+    }
+    const ReportResult result = http.post(message, size) == 200 ? ReportResult::Ok : ReportResult::HttpRequestFailed;
+    if (result == ReportResult::Ok) clearSdStats();
 
     http.end();
     return result;
 }
 
-uint8_t getNtpHour() {
-    WiFiUDP udp;
-    NTPClient client(udp);
-    client.begin();
-    if (!client.update()) return 255;
-    return client.getHours();
+// the SDK keeps querying the server in the background while the images download
+void beginNtp() {
+    configTime(0, 0, NTP_SERVER);
+}
+NtpTime waitNtp(const uint8_t estimated_hour) {
+    NtpTime ntp_time;
+    timeval now;
+    const uint32_t start = millis();
+    while (gettimeofday(&now, nullptr), now.tv_sec < NTP_VALID_TIME) {
+        if (millis() - start >= NTP_TIMEOUT || deadlineExceeded()) return ntp_time;
+        delay(10);
+    }
+    const uint32_t synced_at = millis();
+
+    const uint32_t day_ms = (uint32_t)(now.tv_sec % 86400) * 1000 + now.tv_usec / 1000;
+    ntp_time.hour = day_ms / 3600000;
+    ntp_time.hour_start = (int32_t)synced_at - (int32_t)(day_ms % 3600000);
+    // the wakes are scheduled WAKE_MARGIN after the hour, so only the drift of the rtc is left
+    if (estimated_hour < 24) {
+        int32_t offset = (int32_t)day_ms - (int32_t)((uint32_t)estimated_hour * 3600000 + WAKE_MARGIN + synced_at);
+        if (offset > 43200000) offset -= 86400000;
+        else if (offset < -43200000) offset += 86400000;
+        ntp_time.offset = offset;
+    }
+    return ntp_time;
 }
 
 bool wait(WiFiClient *const stream) {
@@ -59,107 +194,331 @@ bool wait(WiFiClient *const stream) {
     return true;
 }
 
-DownloadResult download(WiFiClient *const stream, const char *const file_name) {
+// tiled is set for images made of tiles, their height comes with the TILED_IMAGE flag
+DownloadResult readSize(WiFiClient *const stream, uint16_t *const width, uint16_t *const height, bool *const tiled) {
+    if (!wait(stream)) return DownloadResult::TooShort;
+    *height = stream->read();
+    if (!wait(stream)) return DownloadResult::TooShort;
+    *height |= stream->read() << 8;
+    *tiled = *height & TILED_IMAGE;
+    *height &= ~TILED_IMAGE;
+
+    if (!wait(stream)) return DownloadResult::TooShort;
+    *width = stream->read();
+    if (!wait(stream)) return DownloadResult::TooShort;
+    *width |= stream->read() << 8;
+    if (!takeBody(4)) return DownloadResult::WrongLength;
+    if (*tiled) return *width <= Epd::WIDTH && *height <= Epd::HEIGHT ? DownloadResult::Ok : DownloadResult::TooLarge;
+    // larger images are rotated or scaled down when displayed
+    if (!get<0>(Epd::layout(*width, *height))) return DownloadResult::TooLarge;
+    return DownloadResult::Ok;
+}
+
+// writes the header and the next byte_count bytes of the stream to the file
+static DownloadResult copy(WiFiClient *const stream, File *const file, const uint8_t *const header, const uint8_t header_size, const uint32_t byte_count) {
+    DownloadResult result = DownloadResult::Ok;
+    uint8_t small_buf[256];
+    uint8_t *buf = small_buf;
+    size_t buf_size = sizeof(small_buf);
+    // a slow card gets the image in fewer, larger writes, if the heap allows
+    if (sdSlow() && (buf = (uint8_t *)malloc(SD_SLOW_WRITE_SIZE))) buf_size = SD_SLOW_WRITE_SIZE;
+    else buf = small_buf;
+    memcpy(buf, header, header_size);
+    size_t buffered = header_size;
+
+    uint8_t failed_read_count = 0;
+    for (uint32_t written = 0; written < byte_count;) {
+        if (deadlineExceeded()) { result = DownloadResult::DeadlineExceeded; goto end; }
+        if (!stream->connected()) { result = DownloadResult::StreamNotConnected; goto end; }
+        const uint32_t read_start = micros();
+        const bool waited = wait(stream);
+        const int read_len = waited ? stream->read(buf + buffered, std::min((size_t)(byte_count - written), buf_size - buffered)) : 0;
+        transfer_us += micros() - read_start;
+        if (!waited) { result = DownloadResult::TooShort; goto end; }
+        if (read_len <= 0) {
+            if (++failed_read_count > 32) { result = DownloadResult::StreamReadFailed; goto end; }
+            delay(10);
+            continue;
+        }
+        buffered += read_len;
+        written += read_len;
+        transfer_bytes += read_len;
+        if (buffered < buf_size) continue;
+        if (sdWrite(file, buf, buffered) != buffered) { result = DownloadResult::WriteFailed; goto end; }
+        buffered = 0;
+    }
+    if (buffered && sdWrite(file, buf, buffered) != buffered) result = DownloadResult::WriteFailed;
+
+    end:
+    if (buf != small_buf) free(buf);
+    return result;
+}
+
+// the generation, the first tile number and the count of the tiles that follow; the dictionary is cut back to the
+// first tile, so the server can start it over, the tiles saved before a failure stay as they are whole
+static DownloadResult downloadTiles(WiFiClient *const stream, uint8_t *const generation) {
+    uint8_t header[5];
+    for (uint8_t i = 0; i < sizeof(header); i += 1) {
+        if (!wait(stream)) return DownloadResult::TooShort;
+        header[i] = stream->read();
+    }
+    *generation = header[0];
+    const uint16_t first = header[1] | (header[2] << 8);
+    const uint16_t count = header[3] | (header[4] << 8);
+    if ((uint32_t)first + count > MAX_TILE_COUNT) return DownloadResult::LimitExceded;
+    if (!takeBody(sizeof(header) + (uint32_t)count * TILE_SIZE)) return DownloadResult::WrongLength;
+
     yield();
+    File tiles = sdOpen(TILES_FILE, FILE_WRITE);
+    if (!tiles) return DownloadResult::CreateFailed;
     DownloadResult result;
-    File file = SD.open(file_name, FILE_WRITE);
-    if (!file) return DownloadResult::CreateFailed;
-    if (!file.truncate(0)) { result = DownloadResult::ClearFailed; goto end; }
-    {
-        if (!wait(stream)) { result = DownloadResult::TooShort; goto end; }
-        uint16_t height = stream->read();
-        if (!wait(stream)) { result = DownloadResult::TooShort; goto end; }
-        height |= stream->read() << 8;
-        if (height > Epd::HEIGHT) { result = DownloadResult::TooLarge; goto end; }
-
-        if (!wait(stream)) { result = DownloadResult::TooShort; goto end; }
-        uint16_t width = stream->read();
-        if (!wait(stream)) { result = DownloadResult::TooShort; goto end; }
-        width |= stream->read() << 8;
-        if (width > Epd::WIDTH) { result = DownloadResult::TooLarge; goto end; }
-        if (!file.write((uint8_t)(width & 0xff)) || !file.write((uint8_t)(width >> 8))) { result = DownloadResult::WriteFailed; goto end; }
-
-        const uint32_t byte_count = (uint32_t)height * (uint32_t)width;
-        uint8_t failed_read_count = 0;
-        for (uint32_t written = 0; written < byte_count;) {
-            uint8_t buf[256];
-            if (!stream->connected()) { result = DownloadResult::StreamNotConnected; goto end; }
-            if (!wait(stream)) { result = DownloadResult::TooShort; goto end; }
-            int read_len = stream->read(buf, std::min((size_t)(byte_count - written), sizeof(buf)));
-            if (read_len <= 0) {
-                if (++failed_read_count > 32) { result = DownloadResult::StreamReadFailed; goto end; }
-                delay(10);
-                continue;
+    const bool existed = tiles.size();
+    const bool same = existed && tiles.seek(0) && tiles.read() == *generation;
+    const uint32_t tile_count = same ? (tiles.size() - 1) / TILE_SIZE : 0;
+    if (first > tile_count) result = DownloadResult::LimitExceded;
+    else if (!sdTruncate(&tiles, same ? 1 + (uint32_t)first * TILE_SIZE : 0)) result = DownloadResult::ClearFailed;
+    else {
+        if (existed && !same) tiles_replaced = true;
+        result = copy(stream, &tiles, generation, same ? 0 : 1, (uint32_t)count * TILE_SIZE);
+    }
+    if (result != DownloadResult::Ok && tiles.size()) sdTruncate(&tiles, 1 + (tiles.size() - 1) / TILE_SIZE * TILE_SIZE);
+    tiles.close();
+    return result;
+}
+
+// the size has already been read from the stream
+DownloadResult download(WiFiClient *const stream, const char *const file_name, const uint16_t width, const uint16_t height, const bool tiled) {
+    yield();
+    uint8_t generation = 0;
+    DownloadResult result = tiled ? downloadTiles(stream, &generation) : DownloadResult::Ok;
+    const uint32_t tile_count = (uint32_t)((width + TILE_WIDTH - 1) / TILE_WIDTH) * ((height + TILE_WIDTH - 1) / TILE_WIDTH);
+    if (result == DownloadResult::Ok && !takeBody(tiled ? tile_count * 2 : (uint32_t)height * width)) result = DownloadResult::WrongLength;
+    if (result == DownloadResult::Ok) {
+        File file = sdOpen(file_name, FILE_WRITE);
+        if (!file) result = DownloadResult::CreateFailed;
+        else {
+            if (!sdTruncate(&file)) result = DownloadResult::ClearFailed;
+            else if (tiled) {
+                const uint16_t tiled_width = width | TILED_IMAGE;
+                const uint8_t header[5] = { (uint8_t)(tiled_width & 0xff), (uint8_t)(tiled_width >> 8), (uint8_t)(height & 0xff), (uint8_t)(height >> 8), generation };
+                result = copy(stream, &file, header, sizeof(header), tile_count * 2);
+            } else {
+                const uint8_t header[2] = { (uint8_t)(width & 0xff), (uint8_t)(width >> 8) };
+                result = copy(stream, &file, header, sizeof(header), (uint32_t)height * width);
             }
-            if (!file.write(buf, read_len)) { result = DownloadResult::WriteFailed; goto end; }
-            written += read_len;
+            file.close();
         }
     }
-    result = DownloadResult::Ok;
+    if (result == DownloadResult::StreamNotConnected || result == DownloadResult::StreamReadFailed || result == DownloadResult::TooShort)
+        transfer_failed = true;
+    return result;
+}
+DownloadResult download(WiFiClient *const stream, const char *const file_name) {
+    uint16_t width, height;
+    bool tiled;
+    const DownloadResult result = readSize(stream, &width, &height, &tiled);
+    if (result != DownloadResult::Ok) return result;
+    return download(stream, file_name, width, height, tiled);
+}
 
-    end:
+// pipes the image straight into the panel, nothing is left on the sd card
+SaveResult displayDownload(WiFiClient *const stream, const char *const file_name) {
+    uint16_t width, height;
+    bool tiled;
+    const DownloadResult size_result = readSize(stream, &width, &height, &tiled);
+    if (size_result != DownloadResult::Ok) return (SaveResult)size_result;
+    if (!width || !height) return SaveResult::Empty;
+
+    if (!tiled && Epd::layout(width, height) == tuple<uint8_t, bool>(1, false)) {
+        if (!takeBody((uint32_t)width * height)) return SaveResult::WrongLength;
+        Epd epd;
+        epd.loadPalette(); // a broken palette is reported by the next night
+        return (SaveResult)epd.displayStream(stream, width, height);
+    }
+
+    // rotating, scaling and the tiles need random access, so the image goes through the sd card
+    const DownloadResult download_result = download(stream, file_name, width, height, tiled);
+    if (download_result != DownloadResult::Ok) {
+        sdRemove(file_name);
+        return (SaveResult)download_result;
+    }
+    File file = sdOpen(file_name, FILE_READ);
+    if (!file) return SaveResult::ReadOpenFailed;
+    Epd epd;
+    epd.loadPalette();
+    const DisplayResult result = epd.displayFile(file);
     file.close();
-    return result;
+    sdRemove(file_name);
+    return (SaveResult)result;
+}
+
+// the request headers that let the server leave out what the device would discard, see README
+struct Capabilities {
+    char panel[12];
+    char formats[32];
+    char tiles[10];
+    char free_slots[4];
+};
+// free_slots for the random images, negative for the schedule
+static void sendCapabilities(Http *const http, Capabilities *const capabilities, const int16_t free_slots) {
+    snprintf(capabilities->panel, sizeof(capabilities->panel), "%ux%u", Epd::WIDTH, Epd::HEIGHT);
+    http->header("X-Panel", capabilities->panel);
+    snprintf(capabilities->formats, sizeof(capabilities->formats), "plain;rotate;scale=%u, tiled", Epd::MAX_SCALE);
+    http->header("X-Image-Formats", capabilities->formats);
+    http->header("Accept-Encoding", "identity");
+    // the server sends only the tiles past the ones the device has
+    const auto [generation, tile_count] = tileDictionary();
+    snprintf(capabilities->tiles, sizeof(capabilities->tiles), "%u/%u", generation, tile_count);
+    http->header("X-Tiles", capabilities->tiles);
+    if (free_slots < 0) return;
+    snprintf(capabilities->free_slots, sizeof(capabilities->free_slots), "%d", free_slots);
+    http->header("X-Free-Slots", capabilities->free_slots);
 }
 
-// result, days_until_current_check
-tuple<SaveResult, uint8_t> saveRecent() {
-    SaveResult result;
+// the response is the days until the next check followed by night offset and image pairs,
+// the image of offset n is displayed by the night n nights after tonight
+// result, days_until_current_check, displayed, tiles_replaced
+tuple<SaveResult, uint8_t, bool, bool> saveRecent(const bool display) {
+    SaveResult result = SaveResult::Ok;
     WiFiClient wifi;
-    HTTPClient http;
+    Http http;
     WiFiClient *stream;
     uint8_t days_until_recent_check = 0;
+    bool displayed = false;
+    Capabilities capabilities;
+    tiles_replaced = false;
 
-    if (!http.begin(wifi, RECENT)) return tuple(SaveResult::HttpBeginFailed, 0);
-    if (http.GET() != 200) { result = SaveResult::HttpRequestFailed; goto http_end; }
+    if (!http.begin(&wifi, RECENT)) return tuple(SaveResult::HttpBeginFailed, 0, false, false);
+    sendCapabilities(&http, &capabilities, -1);
+    if (http.get() != 200) { result = SaveResult::HttpRequestFailed; goto http_end; }
     if (!(stream = http.getStreamPtr())) { result = SaveResult::StreamGetFailed; goto http_end; }
+    body_left = http.contentLength();
 
-    if (!wait(stream)) { result = SaveResult::Empty; goto http_end; }
+    if (!wait(stream) || !takeBody(1)) { result = SaveResult::Empty; goto http_end; }
     days_until_recent_check = stream->read();
     if (days_until_recent_check == 0 || days_until_recent_check > DAYS_UNTIL_RECENT_CHECK_ERROR) { result = SaveResult::LimitExceded; goto http_end; }
-    if (!wait(stream)) { result = SaveResult::Ok; goto stream_stop; }
 
-    result = (SaveResult)download(stream, RECENT_FILE);
-    if (result == SaveResult::ClearFailed) goto stream_stop;
-    if (result != SaveResult::Ok) goto remove;
-    if (stream->available()) { result = SaveResult::WrongLength; goto remove; }
+    // the new schedule replaces whatever is left of the last one
+    yield();
+    if (!removeRecentFiles()) { result = SaveResult::RemoveFailed; goto stream_stop; }
 
-    goto stream_stop;
+    while (wait(stream)) {
+        if (!takeBody(1)) { result = SaveResult::WrongLength; break; }
+        const uint8_t night_offset = stream->read();
+        if (night_offset >= days_until_recent_check) { result = SaveResult::LimitExceded; break; }
+        const RecentName name = recentName(days_until_recent_check - night_offset);
+
+        if (display && night_offset == 0) {
+            result = displayDownload(stream, name.bytes);
+            // the radio stays on for the rest of the sync, its peaks shouldn't add to the refresh on a weak battery
+            Epd::finishRefresh();
+            if (result != SaveResult::Ok) break;
+            displayed = true;
+            continue;
+        }
+
+        result = (SaveResult)download(stream, name.bytes);
+        if (result != SaveResult::Ok) {
+            if (result != SaveResult::ClearFailed) sdRemove(name.bytes);
+            break;
+        }
+    }
+
+    // the connection ended before the length the server gave
+    if (result == SaveResult::Ok && body_left > 0) result = SaveResult::TooShort;
+    // a broken schedule is downloaded again the next day, unless tonight already used it
+    if (result != SaveResult::Ok && !displayed) removeRecentFiles();
 
-    remove:
-    SD.remove(RECENT_FILE);
     stream_stop:
     stream->stop();
     http_end:
     http.end();
-    return tuple(result, result == SaveResult::Ok ? days_until_recent_check : 0);
+    body_left = -1;
+    return tuple(result, result == SaveResult::Ok || displayed ? days_until_recent_check : 0, displayed, tiles_replaced);
 }
-// result, images, min_file_count
-tuple<SaveResult, uint8_t, uint8_t> saveRand(const uint8_t next_rand_file) {
+// an empty response keeps the current palette
+SaveResult savePalette() {
     SaveResult result = SaveResult::Ok;
     WiFiClient wifi;
-    HTTPClient http;
+    Http http;
+    WiFiClient *stream;
+    uint8_t palette[256];
+    File file;
+    char palette_hash[9];
+
+    // the fnv-1a hash of the saved palette, the server leaves the body empty when it is the current one
+    yield();
+    if (SD.exists(PALETTE_FILE) && (file = sdOpen(PALETTE_FILE, FILE_READ))) {
+        if (sdRead(&file, palette, sizeof(palette)) == sizeof(palette) && !file.available()) {
+            uint32_t hash = 2166136261;
+            for (uint16_t i = 0; i < sizeof(palette); i += 1) hash = (hash ^ palette[i]) * 16777619;
+            http.header("X-Palette", utoa(hash, palette_hash, 16));
+        }
+        file.close();
+    }
+
+    if (!http.begin(&wifi, PALETTE)) return SaveResult::HttpBeginFailed;
+    if (http.get() != 200) { result = SaveResult::HttpRequestFailed; goto http_end; }
+    if (!(stream = http.getStreamPtr())) { result = SaveResult::StreamGetFailed; goto http_end; }
+    // an empty body keeps the palette, any other length than a whole one is refused before the sd card is touched
+    if (http.contentLength() == 0) goto stream_stop;
+    if (http.contentLength() > 0 && http.contentLength() != sizeof(palette)) { result = SaveResult::WrongLength; goto stream_stop; }
+    if (!wait(stream)) goto stream_stop;
+
+    if (stream->readBytes(palette, sizeof(palette)) != sizeof(palette)) { result = SaveResult::TooShort; goto stream_stop; }
+    if (stream->available()) { result = SaveResult::WrongLength; goto stream_stop; }
+
+    yield();
+    if (!(file = sdOpen(PALETTE_FILE, FILE_WRITE))) { result = SaveResult::CreateFailed; goto stream_stop; }
+    if (!sdTruncate(&file)) result = SaveResult::ClearFailed;
+    else if (sdWrite(&file, palette, sizeof(palette)) != sizeof(palette)) result = SaveResult::WriteFailed;
+    file.close();
+    if (result != SaveResult::Ok) sdRemove(PALETTE_FILE);
+
+    stream_stop:
+    stream->stop();
+    http_end:
+    http.end();
+    return result;
+}
+
+// result, images, min_file_count, tiles_replaced
+tuple<SaveResult, uint8_t, uint8_t, bool> saveRand(const uint8_t next_rand_file) {
+    SaveResult result = SaveResult::Ok;
+    WiFiClient wifi;
+    Http http;
     WiFiClient *stream;
 
     uint8_t image_count = 0;
     uint8_t min_file_count = 0;
+    Capabilities capabilities;
+    tiles_replaced = false;
 
-    if (!http.begin(wifi, RANDOM)) return tuple(SaveResult::HttpBeginFailed, image_count, min_file_count);
-    if (http.GET() != 200) { result = SaveResult::HttpRequestFailed; goto http_end; }
+    if (!http.begin(&wifi, RANDOM)) return tuple(SaveResult::HttpBeginFailed, image_count, min_file_count, false);
+    // the batch is removed whole if it overflows
+    sendCapabilities(&http, &capabilities, min(MAX_SAVED_IMAGE_COUNT, (uint8_t)(255 - next_rand_file)));
+    if (http.get() != 200) { result = SaveResult::HttpRequestFailed; goto http_end; }
     if (!(stream = http.getStreamPtr())) { result = SaveResult::StreamGetFailed; goto http_end; }
+    body_left = http.contentLength();
 
-    if (!wait(stream)) { result = SaveResult::Empty; goto http_end; }
+    if (!wait(stream) || !takeBody(1)) { result = SaveResult::Empty; goto http_end; }
     min_file_count = stream->read();
     if (min_file_count == 0 || min_file_count > MIN_FILE_COUNT_ERROR) { result = SaveResult::LimitExceded; goto http_end; }
 
     while (wait(stream)) {
-        image_count += 1;
-        if (image_count > MAX_SAVED_IMAGE_COUNT || image_count > 255 - next_rand_file) { result = SaveResult::WrongLength; goto remove; }
+        if (deadlineExceeded()) { result = SaveResult::DeadlineExceeded; goto stream_stop; }
+        if (image_count >= MAX_SAVED_IMAGE_COUNT || image_count >= 255 - next_rand_file) { result = SaveResult::WrongLength; goto remove; }
         const DownloadResult download_result = download(stream, numToName(next_rand_file + image_count).bytes);
-        result = download_result == DownloadResult::Ok ? SaveResult::Ok : (SaveResult)download_result;
-        if (result == SaveResult::CreateFailed) image_count -= 1;
-        if (result != SaveResult::Ok) goto remove;
+        if (download_result == DownloadResult::Ok) { image_count += 1; continue; }
+
+        result = (SaveResult)download_result;
+        // the images saved before the deadline are kept, only the interrupted one is removed
+        if (result == SaveResult::DeadlineExceeded) { sdRemove(numToName(next_rand_file + image_count).bytes); goto stream_stop; }
+        if (result != SaveResult::CreateFailed) image_count += 1;
+        goto remove;
     }
+    // the connection ended before the length the server gave
+    if (body_left > 0) { result = SaveResult::TooShort; goto remove; }
 
     goto stream_stop;
     
@@ -169,7 +528,9 @@ tuple<SaveResult, uint8_t, uint8_t> saveRand(const uint8_t next_rand_file) {
     stream->stop();
     http_end:
     http.end();
-    return result == SaveResult::Ok ? tuple(SaveResult::Ok, image_count, min_file_count) : tuple(result, (uint8_t)0, (uint8_t)0);
+    body_left = -1;
+    if (result == SaveResult::Ok || result == SaveResult::DeadlineExceeded) return tuple(result, image_count, min_file_count, tiles_replaced);
+    return tuple(result, (uint8_t)0, (uint8_t)0, tiles_replaced);
 }
 
 //while (!wifi.connect("concepts.scienceontheweb.net", 80)) delay(500);
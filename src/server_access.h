@@ -2,9 +2,11 @@
 #define DOWNLOAD_H
 
 #include "storage.h"
+#include "deadline.h"
+#include "http.h"
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
-#include <ESP8266HTTPClient.h>
+#include <time.h>
 
 enum class DownloadResult : uint8_t {
     Ok,
@@ -16,8 +18,12 @@ enum class DownloadResult : uint8_t {
     StreamReadFailed   = (uint8_t)Result::StreamReadFailed,
     StreamNotConnected = (uint8_t)Result::StreamNotConnected,
 
+    LimitExceded       = (uint8_t)Result::LimitExceded,
     TooLarge           = (uint8_t)Result::TooLarge,
     TooShort           = (uint8_t)Result::TooShort,
+    WrongLength        = (uint8_t)Result::WrongLength,
+
+    DeadlineExceeded   = (uint8_t)Result::DeadlineExceeded,
 };
 enum class SaveResult : uint8_t {
     Ok,
@@ -25,6 +31,8 @@ enum class SaveResult : uint8_t {
     WriteFailed        = (uint8_t)Result::WriteFailed,
     ClearFailed        = (uint8_t)Result::ClearFailed,
     CreateFailed       = (uint8_t)Result::CreateFailed,
+    ReadOpenFailed     = (uint8_t)Result::ReadOpenFailed,
+    RemoveFailed       = (uint8_t)Result::RemoveFailed,
 
     StreamReadFailed   = (uint8_t)Result::StreamReadFailed,
     StreamNotConnected = (uint8_t)Result::StreamNotConnected,
@@ -37,6 +45,9 @@ enum class SaveResult : uint8_t {
     TooLarge           = (uint8_t)Result::TooLarge,
     TooShort           = (uint8_t)Result::TooShort,
     Empty              = (uint8_t)Result::Empty,
+
+    OutOfMemory        = (uint8_t)Result::OutOfMemory,
+    DeadlineExceeded   = (uint8_t)Result::DeadlineExceeded,
 };
 enum class ReportResult : uint8_t {
     Ok,
@@ -44,19 +55,66 @@ enum class ReportResult : uint8_t {
     HttpRequestFailed = (uint8_t)Result::HttpRequestFailed,
 };
 
+const int32_t NO_CLOCK_OFFSET = INT32_MIN; // the time isn't synchronized or the hour wasn't estimated
+
+// hour, hour_start, offset
+struct NtpTime {
+    uint8_t hour = 255;     // 255 if the time isn't synchronized
+    int32_t hour_start = 0; // millis() when the current hour started, negative if before boot
+    int32_t offset = NO_CLOCK_OFFSET; // synchronized time minus the estimated time in ms
+};
+
+struct LinkHistory {
+    int8_t rssi[LINK_HISTORY_SIZE]; // dBm
+    uint8_t next;
+    uint8_t count;
+    uint8_t level; // index to LINK_SETTINGS
+    uint8_t reserved[3];
+};
+// from the most robust to the most economical
+const struct { WiFiPhyMode_t phy_mode; float tx_power; } LINK_SETTINGS[] = {
+    { WIFI_PHY_MODE_11B, 20.5 },
+    { WIFI_PHY_MODE_11G, 20.5 },
+    { WIFI_PHY_MODE_11N, 20.5 }, // sdk default
+    { WIFI_PHY_MODE_11N, 17 },
+    { WIFI_PHY_MODE_11N, 14 },
+    { WIFI_PHY_MODE_11N, 11 },
+    { WIFI_PHY_MODE_11N, 8 },
+};
+const uint8_t LINK_LEVEL_COUNT = sizeof(LINK_SETTINGS) / sizeof(LINK_SETTINGS[0]);
+const uint8_t DEFAULT_LINK_LEVEL = 2;
+const int8_t RSSI_STRONG = -65; // every saved sample above it lowers the power
+const int8_t RSSI_WEAK = -80;
+const int8_t RSSI_UNKNOWN = 31; // WiFi.RSSI() when the sdk can't tell
+const uint16_t MIN_TRANSFER_RATE = 16000; // B/s, slower downloads raise the power
+
+const uint16_t NTP_TIMEOUT = 2000; // ms, counted after the downloads finish
+const time_t NTP_VALID_TIME = 1577836800; // 2020-01-01, the clock starts at 1970 after boot
+
 const char SSID[] = "your service set identifier";
 const char PSW[] = "your password";
 const char REPORT[] = "your error and battery report server url";
 const char RECENT[] = "your recent file server url";
 const char RANDOM[] = "your random random file server url";
+const char PALETTE[] = "your palette server url";
+const char NTP_SERVER[] = "pool.ntp.org";
 
+void beginWifi();
+// rssi is 0 if the connection failed, healthy says whether the downloads went well
+void recordLink(uint8_t *const error_count, const int8_t rssi, const bool healthy);
+bool transferHealthy();
 void disconnectWifi();
-ReportResult reportBattery(const uint8_t charge);
+// merges the heap watermarks of this wake into the rtc memory, the battery report sends and clears them
+void saveHeapStats(uint8_t *const error_count);
+// the clock offset is sent when it was measured this wake
+ReportResult reportBattery(const uint16_t charge, const int32_t clock_offset);
 ReportResult reportErrors(const FullResult *const errors, const uint8_t error_count);
-uint8_t getNtpHour();
-// result, days_until_current_check
-std::tuple<SaveResult, uint8_t> saveRecent();
-// result, image_count, min_file_count
-std::tuple<SaveResult, uint8_t, uint8_t> saveRand(const uint8_t next_rand_file);
+void beginNtp();
+NtpTime waitNtp(const uint8_t estimated_hour);
+SaveResult savePalette();
+// result, days_until_current_check, displayed, tiles_replaced
+std::tuple<SaveResult, uint8_t, bool, bool> saveRecent(const bool display);
+// result, image_count, min_file_count, tiles_replaced
+std::tuple<SaveResult, uint8_t, uint8_t, bool> saveRand(const uint8_t next_rand_file);
 
 #endif // !DOWNLOAD_H
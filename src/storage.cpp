@@ -22,6 +22,37 @@
 
 using namespace std;
 
+static SdStats sd_stats;
+static bool sd_stats_loaded = false;
+static bool sd_stats_changed = false;
+
+uint32_t rtcChecksum(const uint32_t *const data, const size_t size) {
+    uint32_t checksum = 0x5a5a5a5a;
+    for (size_t i = 0; i < size / 4; i += 1) checksum = ((checksum << 5) | (checksum >> 27)) ^ data[i];
+    return checksum;
+}
+
+tuple<uint16_t, uint16_t> sampleBattery(uint8_t *const error_count) {
+    BatteryHistory history;
+    if (!readRtc(RTC_BATTERY_BLOCK, &history) || history.next >= BATTERY_HISTORY_SIZE || history.count > BATTERY_HISTORY_SIZE)
+        memset(&history, 0, sizeof(history));
+
+    const uint16_t sample = analogRead(A0);
+    history.charges[history.next] = sample;
+    history.next = (history.next + 1) % BATTERY_HISTORY_SIZE;
+    if (history.count < BATTERY_HISTORY_SIZE) history.count += 1;
+    if (!writeRtc(RTC_BATTERY_BLOCK, &history)) writeError(error_count, Type::Generic, Result::RtcWriteFailed);
+
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < history.count; i += 1) sum += history.charges[i];
+    return tuple((uint16_t)(sum / history.count), sample);
+}
+BatteryLevel batteryLevel(const uint16_t charge) {
+    if (charge < BATTERY_CHARGE_WEAK) return BatteryLevel::Weak;
+    if (charge < BATTERY_CHARGE_LOW) return BatteryLevel::Low;
+    return BatteryLevel::Full;
+}
+
 RandName numToName(const uint8_t num) {
     return { (char)(0x40 | (num >> 4)), (char)(0x40 | (num & 0x0f)), 0x00 };
 }
@@ -29,28 +60,78 @@ RandName numToName(const uint8_t num) {
 //    return (name.bytes[0] << 4) | (name.bytes[1] & 0x0f);
 //}
 
+Result readState(File file, State *const state) {
+    if (!file) return Result::ReadOpenFailed;
+    uint8_t bytes[sizeof(State)];
+    const bool complete = file.available() == sizeof(bytes) && file.read(bytes, sizeof(bytes)) == sizeof(bytes);
+    file.close();
+    if (!complete) return Result::WrongLength;
+    memcpy(state, bytes, sizeof(bytes));
+    return Result::Ok;
+}
+Result writeState(File file, const State *const state) {
+    if (!file) return Result::WriteOpenFailed;
+    Result result = Result::Ok;
+    if (!file.truncate(0)) result = Result::ClearFailed;
+    else if (file.write((const uint8_t *)state, sizeof(State)) != sizeof(State)) result = Result::WriteFailed;
+    file.close();
+    return result;
+}
+
+bool isRandName(const char *const name) {
+    return (name[0] & 0xf0) == 0x40 && (name[1] & 0xf0) == 0x40 && name[2] == 0x00;
+}
+RecentName recentName(const uint8_t days_until_recent_check) {
+    return { 'r', (char)(0x40 | (days_until_recent_check >> 4)), (char)(0x40 | (days_until_recent_check & 0x0f)), 0x00 };
+}
+bool isRecentName(const char *const name) {
+    return name[0] == 'r' && isRandName(name + 1);
+}
+// the whole schedule of the last recent check
+bool removeRecentFiles() {
+    File root = SD.open("/");
+    if (!root) return false;
+    bool success = true;
+
+    while (true) {
+        yield();
+        File file = root.openNextFile();
+        if (!file) break;
+        RecentName name = { 0 };
+        if (isRecentName(file.name())) memcpy((char *)name.bytes, file.name(), sizeof(name.bytes));
+        file.close();
+        if (name.bytes[0] && !sdRemove(name.bytes)) success = false;
+    }
+
+    root.close();
+    return success;
+}
+
+// the other files are the state, the recent image and optional ones such as the palette
 tuple<bool, uint8_t> randFileCount() {
     File root = SD.open("/");
     if (!root) return tuple(false, 0);
     uint8_t count = 0;
+    uint8_t other_count = 0;
 
     while (true) {
         yield();
         File file = root.openNextFile();
         if (!file) break;
+        if (isRandName(file.name())) count += 1;
+        else if (!isRecentName(file.name())) other_count += 1;
         file.close();
-        count += 1;
     }
 
     root.close();
-    if (count < 2) return tuple(false, 0);
-    return tuple(true, count - 2);
+    if (other_count < 1) return tuple(false, 0); // the state
+    return tuple(true, count);
 }
 
 RandFilesResult removeFiles(const uint8_t first_inclusive, const uint8_t last_exclusive) {
     for (uint8_t file_index = first_inclusive; file_index < last_exclusive; file_index += 1) {
         yield();
-        if (!SD.remove(numToName(file_index).bytes)) return RandFilesResult::RemoveFailed;
+        if (!sdRemove(numToName(file_index).bytes)) return RandFilesResult::RemoveFailed;
     }
     return RandFilesResult::Ok;
 }
@@ -78,12 +159,12 @@ RandFilesResult shiftFiles(const uint8_t rand_file_count, const uint8_t n) {
     bool remove_failed = false;
     for (uint8_t i = 0; i < n; i += 1) {
         yield();
-        if (!SD.remove(numToName(i).bytes)) remove_failed = true;
+        if (!sdRemove(numToName(i).bytes)) remove_failed = true;
     }
     bool rename_failed = false;
     for (uint8_t i = n; i < rand_file_count; i += 1) {
         yield();
-        if (!SD.rename(numToName(i).bytes, numToName(i - n).bytes)) rename_failed = true;
+        if (!sdRename(numToName(i).bytes, numToName(i - n).bytes)) rename_failed = true;
     }
     return remove_failed ? RandFilesResult::RemoveFailed : rename_failed ? RandFilesResult::RenameFailed : RandFilesResult::Ok;
 }
@@ -100,3 +181,103 @@ void writeError(uint8_t *const error_count, const Type type, const Result result
 void writeError(FullResult *const errors, uint8_t *const error_count, const Type type, const Result error) {
     writeError(errors, error_count, FullResult(type, error));
 }
+
+static void loadSdStats() {
+    if (sd_stats_loaded) return;
+    if (!readRtc(RTC_SD_BLOCK, &sd_stats)) memset(&sd_stats, 0, sizeof(sd_stats));
+    sd_stats_loaded = true;
+}
+void recordSd(const SdOperation operation, const uint32_t start_us) {
+    loadSdStats();
+    const uint32_t elapsed_ms = (micros() - start_us) / 1000;
+    uint8_t bucket = 0;
+    // 1, 4, 16, 64, 256 ms
+    for (uint32_t limit = 1; bucket + 1 < SD_LATENCY_BUCKET_COUNT && elapsed_ms >= limit; limit <<= 2) bucket += 1;
+    uint16_t *const counts = sd_stats.histogram[(uint8_t)operation];
+    if (counts[bucket] == UINT16_MAX) for (uint8_t i = 0; i < SD_LATENCY_BUCKET_COUNT; i += 1) counts[i] >>= 1;
+    counts[bucket] += 1;
+    sd_stats_changed = true;
+}
+File sdOpen(const char *const name, const uint8_t mode) {
+    const uint32_t start = micros();
+    File file = SD.open(name, mode);
+    recordSd(SdOperation::Open, start);
+    return file;
+}
+bool sdRemove(const char *const name) {
+    const uint32_t start = micros();
+    const bool success = SD.remove(name);
+    recordSd(SdOperation::Remove, start);
+    return success;
+}
+bool sdRename(const char *const from, const char *const to) {
+    const uint32_t start = micros();
+    const bool success = SD.rename(from, to);
+    recordSd(SdOperation::Rename, start);
+    return success;
+}
+// a new file is empty already
+bool sdTruncate(File *const file, const uint32_t size) {
+    if (file->size() == size) return true;
+    const uint32_t start = micros();
+    const bool success = file->truncate(size);
+    recordSd(SdOperation::Truncate, start);
+    return success;
+}
+size_t sdRead(File *const file, uint8_t *const buffer, const size_t size) {
+    const uint32_t start = micros();
+    const size_t read = file->read(buffer, size);
+    recordSd(SdOperation::Read, start);
+    return read;
+}
+size_t sdWrite(File *const file, const uint8_t *const buffer, const size_t size) {
+    const uint32_t start = micros();
+    const size_t written = file->write(buffer, size);
+    recordSd(SdOperation::Write, start);
+    return written;
+}
+bool sdSlow() {
+    loadSdStats();
+    return sd_stats.slow;
+}
+const SdStats *sdStats() {
+    loadSdStats();
+    return &sd_stats;
+}
+void clearSdStats() {
+    loadSdStats();
+    memset(sd_stats.histogram, 0, sizeof(sd_stats.histogram));
+    sd_stats_changed = true;
+}
+void saveSdStats(uint8_t *const error_count) {
+    if (!sd_stats_changed) return;
+    if (!sd_stats.slow) {
+        uint32_t count = 0;
+        uint32_t slow_count = 0;
+        for (const SdOperation operation : { SdOperation::Open, SdOperation::Rename, SdOperation::Remove, SdOperation::Truncate }) {
+            for (uint8_t i = 0; i < SD_LATENCY_BUCKET_COUNT; i += 1) {
+                count += sd_stats.histogram[(uint8_t)operation][i];
+                if (i >= SD_SLOW_BUCKET) slow_count += sd_stats.histogram[(uint8_t)operation][i];
+            }
+        }
+        if (count >= SD_SLOW_MIN_SAMPLES && slow_count * SD_SLOW_SHARE > count) {
+            sd_stats.slow = 1;
+            writeError(error_count, Type::Generic, Result::SdSlow);
+        }
+    }
+    if (!writeRtc(RTC_SD_BLOCK, &sd_stats)) writeError(error_count, Type::Generic, Result::RtcWriteFailed);
+    sd_stats_changed = false;
+}
+
+// generation, tile_count
+tuple<uint8_t, uint16_t> tileDictionary() {
+    yield();
+    if (!SD.exists(TILES_FILE)) return tuple(0, 0);
+    File file = sdOpen(TILES_FILE);
+    if (!file) return tuple(0, 0);
+    const int generation = file.read();
+    const uint32_t count = file.size() ? (file.size() - 1) / TILE_SIZE : 0;
+    file.close();
+    if (generation < 0) return tuple(0, 0);
+    return tuple(generation, count < MAX_TILE_COUNT ? count : MAX_TILE_COUNT);
+}
@@ -1,7 +1,11 @@
 #ifndef STORAGE_H
 #define STORAGE_H
 
+#include <Arduino.h>
+#include <FS.h>
+#include <SD.h>
 #include <cstdint>
+#include <cstring>
 #include <pins_arduino.h>
 #include <tuple>
 
@@ -75,6 +79,11 @@ enum class Result : uint8_t {
     NtpUpdateFailed = 21,
     TimeLost = 22,
     SdNotConnected = 23,
+
+    OutOfMemory = 24,
+    DeadlineExceeded = 25,
+    FlashMountFailed = 26,
+    SdSlow = 27,
 };
 enum class Type : uint8_t {
     Generic = 0x00,
@@ -94,7 +103,15 @@ class FullResult {
         uint8_t value;
 };
 
+enum class BatteryLevel : uint8_t {
+    Full,
+    Low,
+    Weak,
+};
+
 typedef struct { const char bytes[3]; } RandName;
+// 'r' followed by the days_until_recent_check value of the night the image belongs to
+typedef struct { const char bytes[4]; } RecentName;
 enum class RandFilesResult : uint8_t {
     Ok,
     RemoveFailed = (uint8_t)Result::RemoveFailed,
@@ -105,24 +122,155 @@ const uint8_t ERROR_BUFFER_SIZE = 16;
 const uint8_t ERROR_COUNT_ADDRESS = 16;
 const uint8_t EPD_CLEARED_ADDRESS = 17;
 
-const uint8_t MIN_FILE_COUNT_ERROR = 128;
-const uint8_t MIN_FILE_COUNT_WARNING = 64;
-const uint8_t DAYS_UNTIL_RECENT_CHECK_ERROR = 64;
-const uint8_t DAYS_UNTIL_RECENT_CHECK_WARNING = 32;
-const uint8_t MAX_SAVED_IMAGE_COUNT = 64;
+// the simulator in tools/sim sweeps the tunables, so it builds them as variables
+#ifdef SIMULATOR
+#define TUNABLE inline
+#else
+#define TUNABLE const
+#endif
 
-const uint8_t DAYS_UNTIL_BATTERY_CHECK = 7;
+TUNABLE uint8_t MIN_FILE_COUNT_ERROR = 128;
+TUNABLE uint8_t MIN_FILE_COUNT_WARNING = 64;
+TUNABLE uint8_t DAYS_UNTIL_RECENT_CHECK_ERROR = 64;
+TUNABLE uint8_t DAYS_UNTIL_RECENT_CHECK_WARNING = 32;
+TUNABLE uint8_t MAX_SAVED_IMAGE_COUNT = 64;
+
+TUNABLE uint8_t DAYS_UNTIL_BATTERY_CHECK = 7;
+const uint8_t BATTERY_CHARGE_LOW = 204;
+const uint8_t BATTERY_CHARGE_WEAK = 153;
 const uint8_t BATTERY_CHARGE_WARNING = 102;
 const uint8_t BATTERY_CHARGE_ERROR = 51;
+const uint8_t BATTERY_HISTORY_SIZE = 8;
+const uint8_t LINK_HISTORY_SIZE = 6;
+
+TUNABLE uint8_t DEFAULT_MIN_FILE_COUNT = 30;
+TUNABLE uint8_t MAX_FAILED_WIFI_CONNECTIONS = 3;
+TUNABLE uint8_t WAKE_INTERVAL = 3; // hours, 1, 2 or 3: a longer interval can step over the 3 hour night and day windows,
+                                    // a shorter one leaves the later wakes of a window idle
+const uint16_t WAKE_MARGIN = 30000; // ms after the hour starts, covers the deep sleep timer drift
 
-const uint8_t DEFAULT_MIN_FILE_COUNT = 30;
-const uint8_t MAX_FAILED_WIFI_CONNECTIONS = 3;
+// rtc user memory blocks, 4 bytes each, every record is followed by a checksum block
+const uint8_t RTC_HOUR_BLOCK = 0;
+const uint8_t RTC_BATTERY_BLOCK = 1;
+const uint8_t RTC_LINK_BLOCK = 7;
+const uint8_t RTC_SD_BLOCK = 11;
+const uint8_t RTC_WAKE_BLOCK = 31;
+const uint8_t RTC_HEAP_BLOCK = 34;
 
 const uint8_t SD_CS = D8;
+const uint16_t SD_BLOCK_SIZE = 512; // B, the card reads whole blocks
+const uint8_t SD_LATENCY_BUCKET_COUNT = 6; // below 1, 4, 16, 64 and 256 ms, and the rest
+const uint8_t SD_SLOW_BUCKET = 4;          // the metadata operations from here on are slow
+const uint8_t SD_SLOW_MIN_SAMPLES = 16;
+const uint8_t SD_SLOW_SHARE = 8;           // a card is slow when more than 1/8 of its metadata operations are
+const uint16_t SD_SLOW_WRITE_SIZE = 4096;  // B, slow cards get fewer, larger writes
 const char STATE_FILE[] = "state";
-const char RECENT_FILE[] = "recent";
+const char PALETTE_FILE[] = "palette";
+// tiled images are made of TILE_WIDTH x TILE_WIDTH pixel pairs from this file, see README,
+// it starts with its generation byte and a dictionary of another generation replaces it
+const char TILES_FILE[] = "tiles";
+const uint8_t TILE_WIDTH = 8; // in bytes and rows
+const uint8_t TILE_SIZE = TILE_WIDTH * TILE_WIDTH;
+const uint16_t TILED_IMAGE = 0x8000; // flag in the height sent and in the width saved
+const uint16_t MAX_TILE_COUNT = UINT16_MAX;
+// internal flash
+const char FLASH_STATE_FILE[] = "/state";
+const char FRAME_FILE[] = "/frame";
+
+struct State {
+    uint8_t next_image;
+    uint8_t images_read;
+    uint8_t days_until_recent_check;
+    uint8_t days_until_battery_check;
+    uint8_t failed_wifi_connections;
+    uint8_t min_file_count;
+};
+
+enum class SdOperation : uint8_t {
+    Open,
+    Read,
+    Write,
+    Rename,
+    Remove,
+    Truncate,
+};
+const uint8_t SD_OPERATION_COUNT = 6;
+
+// the counts of an operation are halved instead of overflowing, the shares stay
+struct SdStats {
+    uint16_t histogram[SD_OPERATION_COUNT][SD_LATENCY_BUCKET_COUNT];
+    uint8_t slow; // stays until the power is lost, as the card can't be swapped before
+    uint8_t reserved[3];
+};
+
+// the idle wakes since the last battery report, the awake time is capped at UINT16_MAX us
+struct WakeStats {
+    uint16_t count;
+    uint16_t max_us;
+    uint32_t total_us;
+};
+
+// the heap watermarks of the networked wakes since the last battery report
+struct HeapStats {
+    uint16_t min_free_heap; // UINT16_MAX without a sample
+    uint8_t max_fragmentation;
+    uint8_t reserved;
+};
+
+struct BatteryHistory {
+    uint16_t charges[BATTERY_HISTORY_SIZE];
+    uint8_t next;
+    uint8_t count;
+    uint16_t reserved;
+};
+
+uint32_t rtcChecksum(const uint32_t *const data, const size_t size);
+template <typename T>
+bool readRtc(const uint8_t block, T *const data) {
+    static_assert(sizeof(T) % 4 == 0, "rtc records are made of whole blocks");
+    uint32_t blocks[sizeof(T) / 4 + 1];
+    if (!ESP.rtcUserMemoryRead(block, blocks, sizeof(blocks))) return false;
+    if (blocks[sizeof(T) / 4] != rtcChecksum(blocks, sizeof(T))) return false;
+    memcpy(data, blocks, sizeof(T));
+    return true;
+}
+template <typename T>
+bool writeRtc(const uint8_t block, const T *const data) {
+    static_assert(sizeof(T) % 4 == 0, "rtc records are made of whole blocks");
+    uint32_t blocks[sizeof(T) / 4 + 1];
+    memcpy(blocks, data, sizeof(T));
+    blocks[sizeof(T) / 4] = rtcChecksum(blocks, sizeof(T));
+    return ESP.rtcUserMemoryWrite(block, blocks, sizeof(blocks));
+}
+
+// charge averaged over the history, charge of this wake
+std::tuple<uint16_t, uint16_t> sampleBattery(uint8_t *const error_count);
+BatteryLevel batteryLevel(const uint16_t charge);
+
+// the sd card operations are timed into histograms kept in the rtc memory
+File sdOpen(const char *const name, const uint8_t mode = FILE_READ);
+bool sdRemove(const char *const name);
+bool sdRename(const char *const from, const char *const to);
+bool sdTruncate(File *const file, const uint32_t size = 0);
+size_t sdRead(File *const file, uint8_t *const buffer, const size_t size);
+size_t sdWrite(File *const file, const uint8_t *const buffer, const size_t size);
+void recordSd(const SdOperation operation, const uint32_t start_us);
+bool sdSlow();
+const SdStats *sdStats();
+void clearSdStats();
+// classifies the card and writes the histograms back, a no-op if the card wasn't touched
+void saveSdStats(uint8_t *const error_count);
+// generation, whole tiles in the dictionary; both 0 without one
+std::tuple<uint8_t, uint16_t> tileDictionary();
+
+Result readState(File file, State *const state);
+Result writeState(File file, const State *const state);
 
 RandName numToName(const uint8_t num);
+bool isRandName(const char *const name);
+RecentName recentName(const uint8_t days_until_recent_check);
+bool isRecentName(const char *const name);
+bool removeRecentFiles();
 std::tuple<bool, uint8_t> randFileCount();
 RandFilesResult removeFiles(const uint8_t first_inclusive, const uint8_t last_exclusive);
 //RandFilesResult shiftFiles(const uint8_t rand_file_count);
@@ -0,0 +1,887 @@
+// caches the image endpoints of the origin server for the devices of a local network and forwards their reports
+//
+// usage: proxy -o host[:port] [-d dir] [-p port] [-s schedule_path] [-m max_age] [-r report_interval]
+//
+// the devices get the proxy in place of the origin in their urls (http://proxy:8080/random), paths and parameters
+// are passed on as they are; a response is cached by its path, parameters and the capability headers of the device,
+// so devices that should get random images of their own need urls of their own (a device parameter)
+
+#include "storage.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <dirent.h>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+const char DEFAULT_DIRECTORY[] = "proxy";
+const uint16_t DEFAULT_PORT = 8080;
+const uint32_t DEFAULT_MAX_AGE = 600;        // s, a cached response is checked with the origin when it is older
+const uint32_t DEFAULT_REPORT_INTERVAL = 10; // s between the report batches
+const char CACHE_DIRECTORY[] = "cache";      // the responses, named by the hash of their key
+const char SPOOL_FILE[] = "reports";         // the reports the origin didn't take yet
+const size_t MAX_HEADER_SIZE = 4096;
+const size_t MAX_REPORT_SIZE = 1024;         // B, the firmware posts under 100
+const size_t MAX_RESPONSE_SIZE = 64 << 20;   // B of an origin body
+const size_t MAX_QUEUED_REPORTS = 1 << 20;
+const size_t MAX_BATCH = 1024;               // reports per origin connection, a full batch doesn't wait for the interval
+const uint32_t MAX_REFRESHES = 8;            // origin connections refreshing the responses ahead of the devices
+const int64_t STALE_AFTER = 1000;            // ms a device waits for the origin before it gets the cached response, it gives up at 2000
+const int64_t ORIGIN_TIMEOUT = 10000;        // ms of an origin connection
+const int64_t DEVICE_TIMEOUT = 20000;        // ms of a device connection
+const int64_t RETRY_INTERVAL = 30000;        // ms after a failed fetch, until then the cached response is served right away
+const uint32_t EVICT_AGE = 7 * 86400;        // s without a request, then a response is dropped
+const int TICK = 100;                        // ms
+
+// the origin answers by them, so they are forwarded and part of the cache key
+const char *const VARY_HEADERS[] = { "X-Panel:", "X-Image-Formats:", "X-Tiles:", "X-Free-Slots:", "X-Palette:", "Accept-Encoding:" };
+
+struct Options {
+    string origin; // host[:port]
+    string directory = DEFAULT_DIRECTORY;
+    uint16_t port = DEFAULT_PORT;
+    string schedule; // path of the RECENT url
+    uint32_t max_age = DEFAULT_MAX_AGE;
+    uint32_t report_interval = DEFAULT_REPORT_INTERVAL;
+};
+
+static int64_t monotonic() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// schedule //
+
+// a night is counted from noon local time, the devices check the schedule in the afternoon or early in the night
+static int32_t night(const time_t time) {
+    const time_t shifted = time - 12 * 3600;
+    tm local;
+    localtime_r(&shifted, &local);
+    tm date = {};
+    date.tm_year = local.tm_year;
+    date.tm_mon = local.tm_mon;
+    date.tm_mday = local.tm_mday;
+    return timegm(&date) / 86400;
+}
+
+static uint16_t readShort(const string &body, const size_t at) {
+    return (uint8_t)body[at] | ((uint8_t)body[at + 1] << 8);
+}
+// bytes of the image at the offset, 0 if the body ends within it
+static size_t imageSize(const string &body, const size_t at) {
+    if (body.size() - at < 4) return 0;
+    const uint16_t height = readShort(body, at);
+    const uint16_t width = readShort(body, at + 2);
+    size_t size = 4 + (size_t)height * width;
+    if (height & TILED_IMAGE) {
+        if (body.size() - at < 9) return 0;
+        const size_t rows = ((height & ~TILED_IMAGE) + TILE_WIDTH - 1) / TILE_WIDTH;
+        const size_t columns = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+        size = 9 + (size_t)readShort(body, at + 7) * TILE_SIZE + rows * columns * 2;
+    }
+    return size <= body.size() - at ? size : 0;
+}
+// the schedule as it reads the given nights after it was fetched: the images of the nights gone are dropped and the
+// offsets count from tonight; a schedule that ran out, or whose dropped images carry tiles the others need, becomes
+// an empty one of one day, so the device checks again tomorrow
+static string shiftSchedule(const string &body, const int32_t nights) {
+    const string empty(1, (char)1);
+    if (body.empty() || (uint8_t)body[0] <= nights) return empty;
+    string shifted(1, (char)((uint8_t)body[0] - nights));
+    for (size_t at = 1; at < body.size();) {
+        const uint8_t offset = body[at];
+        const size_t size = imageSize(body, at + 1);
+        // a broken schedule is passed on as it is, the device reports it
+        if (!size) return body;
+        if (offset >= nights) {
+            shifted += (char)(offset - nights);
+            shifted.append(body, at + 1, size);
+        } else if ((readShort(body, at + 1) & TILED_IMAGE) && readShort(body, at + 8)) return empty;
+        at += 1 + size;
+    }
+    return shifted;
+}
+
+// origin //
+
+struct Response {
+    uint16_t status = 0;
+    string body;
+    string etag;
+    string last_modified;
+};
+
+enum class ParseResult : uint8_t {
+    Incomplete,
+    Complete,
+    Invalid,
+};
+
+static string fieldValue(const string &field, const size_t name_size) {
+    const size_t start = field.find_first_not_of(" \t", name_size);
+    return start == string::npos ? "" : field.substr(start);
+}
+
+// the response from start on, closed once the origin closed the connection; consumed is set past its end
+static ParseResult parseResponse(const string &data, const size_t start, const bool closed, size_t *const consumed, Response *const response) {
+    const size_t header_end = data.find("\r\n\r\n", start);
+    if (header_end == string::npos) return closed || data.size() - start > MAX_HEADER_SIZE ? ParseResult::Invalid : ParseResult::Incomplete;
+    if (data.compare(start, 9, "HTTP/1.1 ") && data.compare(start, 9, "HTTP/1.0 ")) return ParseResult::Invalid;
+    *response = Response();
+    response->status = atoi(data.c_str() + start + 9);
+
+    long long content_length = -1;
+    bool chunked = false;
+    for (size_t line = data.find("\r\n", start) + 2; line < header_end + 2;) {
+        const size_t end = data.find("\r\n", line);
+        const string field = data.substr(line, end - line);
+        if (!strncasecmp(field.c_str(), "Content-Length:", 15)) content_length = atoll(field.c_str() + 15);
+        else if (!strncasecmp(field.c_str(), "Transfer-Encoding:", 18)) chunked = strcasestr(field.c_str(), "chunked");
+        else if (!strncasecmp(field.c_str(), "ETag:", 5)) response->etag = fieldValue(field, 5);
+        else if (!strncasecmp(field.c_str(), "Last-Modified:", 14)) response->last_modified = fieldValue(field, 14);
+        line = end + 2;
+    }
+
+    size_t at = header_end + 4;
+    if (response->status == 204 || response->status == 304 || response->status / 100 == 1) {
+        *consumed = at;
+        return ParseResult::Complete;
+    }
+    // the devices can't read chunks, they get the body whole
+    if (chunked) {
+        while (true) {
+            const size_t line_end = data.find("\r\n", at);
+            if (line_end == string::npos) return closed ? ParseResult::Invalid : ParseResult::Incomplete;
+            char *size_end;
+            const unsigned long size = strtoul(data.c_str() + at, &size_end, 16);
+            if (size_end == data.c_str() + at) return ParseResult::Invalid;
+            at = line_end + 2;
+            if (!size) {
+                // the trailer fields end with an empty line
+                if (!data.compare(at, 2, "\r\n")) *consumed = at + 2;
+                else {
+                    const size_t trailer_end = data.find("\r\n\r\n", at);
+                    if (trailer_end == string::npos) return closed ? ParseResult::Invalid : ParseResult::Incomplete;
+                    *consumed = trailer_end + 4;
+                }
+                return ParseResult::Complete;
+            }
+            if (response->body.size() + size > MAX_RESPONSE_SIZE) return ParseResult::Invalid;
+            if (data.size() < at + size + 2) return closed ? ParseResult::Invalid : ParseResult::Incomplete;
+            response->body.append(data, at, size);
+            at += size + 2;
+        }
+    }
+    if (content_length >= 0) {
+        if ((size_t)content_length > MAX_RESPONSE_SIZE) return ParseResult::Invalid;
+        if (data.size() - at < (size_t)content_length) return closed ? ParseResult::Invalid : ParseResult::Incomplete;
+        response->body = data.substr(at, content_length);
+        *consumed = at + content_length;
+        return ParseResult::Complete;
+    }
+    // the body ends with the connection
+    if (data.size() - at > MAX_RESPONSE_SIZE) return ParseResult::Invalid;
+    if (!closed) return ParseResult::Incomplete;
+    response->body = data.substr(at);
+    *consumed = data.size();
+    return ParseResult::Complete;
+}
+
+// proxy //
+
+// a device, it sends one request and reads the response until the connection closes
+struct Connection {
+    string input;
+    shared_ptr<const string> output;
+    size_t sent = 0;
+    int64_t opened = 0;
+    string waiting_for; // the key of the fetch
+    int64_t waiting_since = 0;
+    char address[INET6_ADDRSTRLEN] = {};
+};
+
+struct Entry {
+    string body;
+    string etag;
+    string last_modified;
+    time_t fetched = 0;   // when the origin sent the body, the schedule is shifted by the nights since
+    time_t validated = 0; // when the origin last confirmed it
+    time_t used = 0;
+    bool cached = false;
+    bool requested = false; // since validated, so it is refreshed ahead of the next device
+    int64_t failed = 0;     // ms of the last failed fetch, 0 after a successful one
+    int fetch = -1;         // the origin connection
+    vector<int> waiting;    // devices, the ones that got an answer meanwhile are skipped
+    shared_ptr<const string> response; // the status line, headers and body for the devices, shifted to response_night
+    int32_t response_night = 0;
+};
+
+// an origin connection, it fetches a response or posts a batch of reports
+struct Upstream {
+    string key; // empty for a batch
+    size_t reports = 0;
+    string output;
+    size_t sent = 0;
+    string input;
+    bool connected = false;
+    int64_t started = 0;
+};
+
+struct QueuedReport {
+    string target;
+    string body;
+};
+
+struct Proxy {
+    Options options;
+    int poll = -1;
+    sockaddr_storage origin = {};
+    socklen_t origin_size = 0;
+    unordered_map<int, Connection> connections;
+    unordered_map<int, Upstream> upstreams;
+    unordered_map<string, Entry> entries;
+    deque<QueuedReport> reports;
+    FILE *spool = nullptr;
+    uint32_t fetches = 0;
+    bool batch_running = false;
+    int64_t last_batch = 0;
+    int64_t last_maintenance = 0;
+    uint64_t hits = 0;
+    uint64_t stale = 0;
+    uint64_t misses = 0;
+    uint64_t failures = 0;
+    uint64_t forwarded = 0;
+};
+
+static volatile sig_atomic_t stopping = false;
+static void stop(int) {
+    stopping = true;
+}
+
+static const char *status(const uint16_t code) {
+    switch (code) {
+        case 200: return "200 OK";
+        case 400: return "400 Bad Request";
+        case 405: return "405 Method Not Allowed";
+        case 411: return "411 Length Required";
+        case 413: return "413 Payload Too Large";
+        case 502: return "502 Bad Gateway";
+        case 503: return "503 Service Unavailable";
+        case 504: return "504 Gateway Timeout";
+    }
+    return "500 Internal Server Error";
+}
+// built once and shared by every device it goes to
+static shared_ptr<const string> httpResponse(const uint16_t code, const string &body = "") {
+    char header[96];
+    snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status(code), body.size());
+    const shared_ptr<string> response = make_shared<string>(header);
+    response->append(body);
+    return response;
+}
+
+static bool hasParameter(const string &target, const char *const name) {
+    const size_t name_size = strlen(name);
+    const size_t query = target.find('?');
+    if (query == string::npos) return false;
+    for (size_t start = query + 1; start < target.size();) {
+        size_t end = target.find('&', start);
+        if (end == string::npos) end = target.size();
+        if (!target.compare(start, name_size, name) && target[start + name_size] == '=') return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+static void watch(const Proxy &proxy, const int fd, const uint32_t events, const int operation) {
+    epoll_event event = { events, { .fd = fd } };
+    epoll_ctl(proxy.poll, operation, fd, &event);
+}
+
+// cache files //
+
+// fnv-1a, the key itself is in the file
+static string cachePath(const Proxy &proxy, const string &key) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char c : key) hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return proxy.options.directory + "/" + CACHE_DIRECTORY + "/" + name;
+}
+
+// written next to the old one and renamed over it, so a crash leaves one of them whole
+static void saveEntry(const Proxy &proxy, const string &key, const Entry &entry) {
+    const string path = cachePath(proxy, key);
+    const string temporary = path + ".new";
+    FILE *const file = fopen(temporary.c_str(), "wb");
+    if (!file) { perror(temporary.c_str()); return; }
+    fprintf(file, "%lld %lld %zu\n", (long long)entry.fetched, (long long)entry.validated, key.size());
+    fwrite(key.data(), 1, key.size(), file);
+    fprintf(file, "\n%s\n%s\n", entry.etag.c_str(), entry.last_modified.c_str());
+    const bool written = fwrite(entry.body.data(), 1, entry.body.size(), file) == entry.body.size();
+    if (fclose(file) || !written || rename(temporary.c_str(), path.c_str())) {
+        perror(path.c_str());
+        unlink(temporary.c_str());
+    }
+}
+
+static bool readLine(FILE *const file, string *const line) {
+    char buffer[512];
+    if (!fgets(buffer, sizeof(buffer), file)) return false;
+    *line = buffer;
+    if (line->empty() || line->back() != '\n') return false;
+    line->pop_back();
+    return true;
+}
+
+// the responses of the last run, so a restart while the origin is down still has them
+static void loadEntries(Proxy *const proxy) {
+    const string directory = proxy->options.directory + "/" + CACHE_DIRECTORY;
+    DIR *const listing = opendir(directory.c_str());
+    if (!listing) return;
+    while (const dirent *const item = readdir(listing)) {
+        const string name = item->d_name;
+        if (name.size() != 16 || name.find_first_not_of("0123456789abcdef") != string::npos) continue;
+
+        FILE *const file = fopen((directory + "/" + name).c_str(), "rb");
+        if (!file) continue;
+        Entry entry;
+        string times, key;
+        long long fetched, validated;
+        size_t key_size;
+        if (readLine(file, &times) && sscanf(times.c_str(), "%lld %lld %zu", &fetched, &validated, &key_size) == 3 &&
+            key_size <= MAX_HEADER_SIZE && (key.resize(key_size), fread(&key[0], 1, key_size, file) == key_size) &&
+            fgetc(file) == '\n' && readLine(file, &entry.etag) && readLine(file, &entry.last_modified)) {
+            char buffer[65536];
+            size_t size;
+            while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) entry.body.append(buffer, size);
+            entry.fetched = fetched;
+            entry.validated = validated;
+            entry.used = time(nullptr);
+            entry.cached = true;
+            proxy->entries[key] = move(entry);
+        }
+        fclose(file);
+    }
+    closedir(listing);
+}
+
+// report spool //
+
+static void writeReport(FILE *const file, const QueuedReport &report) {
+    const uint8_t sizes[4] = { (uint8_t)(report.target.size() & 0xff), (uint8_t)(report.target.size() >> 8),
+                               (uint8_t)(report.body.size() & 0xff), (uint8_t)(report.body.size() >> 8) };
+    fwrite(sizes, 1, sizeof(sizes), file);
+    fwrite(report.target.data(), 1, report.target.size(), file);
+    fwrite(report.body.data(), 1, report.body.size(), file);
+}
+
+static void loadReports(Proxy *const proxy) {
+    const string path = proxy->options.directory + "/" + SPOOL_FILE;
+    FILE *const file = fopen(path.c_str(), "rb");
+    if (!file) return;
+    uint8_t sizes[4];
+    while (fread(sizes, 1, sizeof(sizes), file) == sizeof(sizes)) {
+        QueuedReport report;
+        report.target.resize(sizes[0] | (sizes[1] << 8));
+        report.body.resize(sizes[2] | (sizes[3] << 8));
+        // a record torn by a crash ends the spool
+        if (fread(&report.target[0], 1, report.target.size(), file) != report.target.size()) break;
+        if (fread(&report.body[0], 1, report.body.size(), file) != report.body.size()) break;
+        proxy->reports.push_back(move(report));
+    }
+    fclose(file);
+}
+
+// the spool is rewritten from the queue after every batch, the reports in between are appended to it
+static bool openSpool(Proxy *const proxy) {
+    const string path = proxy->options.directory + "/" + SPOOL_FILE;
+    const string temporary = path + ".new";
+    if (proxy->spool) fclose(proxy->spool);
+    proxy->spool = nullptr;
+
+    FILE *const file = fopen(temporary.c_str(), "wb");
+    if (!file) { perror(temporary.c_str()); return false; }
+    for (const QueuedReport &report : proxy->reports) writeReport(file, report);
+    if (fclose(file) || rename(temporary.c_str(), path.c_str())) { perror(path.c_str()); return false; }
+    if (!(proxy->spool = fopen(path.c_str(), "ab"))) { perror(path.c_str()); return false; }
+    return true;
+}
+
+// device connections //
+
+static void closeConnection(Proxy *const proxy, const int fd) {
+    close(fd);
+    proxy->connections.erase(fd);
+}
+
+// the connection is closed once the response is out
+static void flushConnection(Proxy *const proxy, const int fd) {
+    Connection &connection = proxy->connections[fd];
+    while (connection.sent < connection.output->size()) {
+        const ssize_t result = send(fd, connection.output->data() + connection.sent, connection.output->size() - connection.sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) break;
+            watch(*proxy, fd, EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_MOD);
+            return;
+        }
+        connection.sent += result;
+    }
+    closeConnection(proxy, fd);
+}
+
+static void reply(Proxy *const proxy, const int fd, const shared_ptr<const string> &response) {
+    Connection &connection = proxy->connections[fd];
+    connection.waiting_for.clear();
+    connection.output = response;
+    connection.sent = 0;
+    flushConnection(proxy, fd);
+}
+
+// the cached response as the devices get it, the schedule is shifted to tonight
+static shared_ptr<const string> entryResponse(const Proxy &proxy, const string &key, Entry *const entry) {
+    const bool schedule = !proxy.options.schedule.empty() && !key.compare(0, key.find_first_of("?\n"), proxy.options.schedule);
+    const int32_t tonight = schedule ? night(time(nullptr)) : 0;
+    if (entry->response && entry->response_night == tonight) return entry->response;
+    const int32_t nights = schedule ? tonight - night(entry->fetched) : 0;
+    entry->response = httpResponse(200, nights > 0 ? shiftSchedule(entry->body, nights) : entry->body);
+    entry->response_night = tonight;
+    return entry->response;
+}
+
+// upstream connections //
+
+static int connectOrigin(Proxy *const proxy, Upstream &&upstream) {
+    const int fd = socket(proxy->origin.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("proxy: socket"); return -1; }
+    const int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    if (connect(fd, (const sockaddr *)&proxy->origin, proxy->origin_size) && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    upstream.started = monotonic();
+    proxy->upstreams[fd] = move(upstream);
+    watch(*proxy, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_ADD);
+    return fd;
+}
+
+// null response if the origin didn't answer
+static void finishFetch(Proxy *const proxy, const string &key, const Response *const response) {
+    Entry &entry = proxy->entries[key];
+    entry.fetch = -1;
+    const time_t now = time(nullptr);
+    if (response && response->status == 200) {
+        entry.body = response->body;
+        entry.etag = response->etag;
+        entry.last_modified = response->last_modified;
+        entry.fetched = entry.validated = now;
+        entry.cached = true;
+        entry.requested = false;
+        entry.failed = 0;
+        entry.response.reset();
+        saveEntry(*proxy, key, entry);
+    } else if (response && response->status == 304 && entry.cached) {
+        entry.validated = now;
+        entry.requested = false;
+        entry.failed = 0;
+    } else if (response && response->status < 500) {
+        // the origin answers, but not with a body to keep
+        entry.cached = false;
+    } else {
+        proxy->failures += 1;
+        entry.failed = monotonic();
+    }
+
+    const vector<int> waiting = move(entry.waiting);
+    entry.waiting.clear();
+    const shared_ptr<const string> answer = entry.cached ? entryResponse(*proxy, key, &entry) : httpResponse(response ? 502 : 504);
+    for (const int fd : waiting) {
+        const auto connection = proxy->connections.find(fd);
+        if (connection == proxy->connections.end() || connection->second.waiting_for != key) continue;
+        if (entry.cached && entry.failed) proxy->stale += 1;
+        else proxy->misses += 1;
+        reply(proxy, fd, answer);
+    }
+    if (!entry.cached) {
+        unlink(cachePath(*proxy, key).c_str());
+        proxy->entries.erase(key);
+    }
+}
+
+static void fetch(Proxy *const proxy, const string &key, Entry *const entry) {
+    Upstream upstream;
+    upstream.key = key;
+    // the key is the target, then the header lines of the device
+    const size_t target_end = key.find('\n');
+    upstream.output = "GET " + key.substr(0, target_end) + " HTTP/1.1\r\nHost: " + proxy->options.origin + "\r\n";
+    if (target_end != string::npos) upstream.output += key.substr(target_end + 1);
+    // the cached body is only sent again if it changed
+    if (entry->cached && !entry->etag.empty()) upstream.output += "If-None-Match: " + entry->etag + "\r\n";
+    if (entry->cached && !entry->last_modified.empty()) upstream.output += "If-Modified-Since: " + entry->last_modified + "\r\n";
+    upstream.output += "Connection: close\r\n\r\n";
+    entry->fetch = connectOrigin(proxy, move(upstream));
+    if (entry->fetch >= 0) proxy->fetches += 1;
+    else finishFetch(proxy, key, nullptr);
+}
+
+// every report is still a post of its own, so the origin takes them as the devices sent them;
+// the reports answered before a broken connection may be sent again
+static void sendBatch(Proxy *const proxy) {
+    proxy->last_batch = monotonic();
+    Upstream upstream;
+    upstream.reports = min(proxy->reports.size(), MAX_BATCH);
+    for (size_t i = 0; i < upstream.reports; i += 1) {
+        const QueuedReport &report = proxy->reports[i];
+        upstream.output += "POST " + report.target + " HTTP/1.1\r\nHost: " + proxy->options.origin +
+                           "\r\nContent-Type: application/octet-stream\r\nContent-Length: " + to_string(report.body.size()) +
+                           (i + 1 == upstream.reports ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n");
+        upstream.output += report.body;
+    }
+    if (connectOrigin(proxy, move(upstream)) >= 0) proxy->batch_running = true;
+}
+
+// the count of the leading reports the origin took, false while more answers can come
+static bool readAnswers(const Upstream &upstream, const bool closed, size_t *const accepted) {
+    *accepted = 0;
+    Response response;
+    size_t at = 0, consumed;
+    while (*accepted < upstream.reports) {
+        const ParseResult result = parseResponse(upstream.input, at, closed, &consumed, &response);
+        if (result == ParseResult::Incomplete) return false;
+        // a report the origin rejects as broken won't get better, one it can't take now is sent again
+        if (result == ParseResult::Invalid || response.status >= 500) return true;
+        *accepted += 1;
+        at = consumed;
+    }
+    return true;
+}
+
+// closes the connection once its response is complete, or right away if it failed
+static void processUpstream(Proxy *const proxy, const int fd, const bool closed, const bool failed) {
+    Upstream &upstream = proxy->upstreams[fd];
+    Response response;
+    size_t accepted = 0;
+    bool answered = false;
+    if (!upstream.key.empty()) {
+        size_t consumed;
+        const ParseResult result = failed ? ParseResult::Invalid : parseResponse(upstream.input, 0, closed, &consumed, &response);
+        if (result == ParseResult::Incomplete) return;
+        answered = result == ParseResult::Complete;
+    } else if (!readAnswers(upstream, closed || failed, &accepted)) return;
+
+    const Upstream done = move(upstream);
+    close(fd);
+    proxy->upstreams.erase(fd);
+    if (!done.key.empty()) {
+        proxy->fetches -= 1;
+        finishFetch(proxy, done.key, answered ? &response : nullptr);
+        return;
+    }
+    proxy->batch_running = false;
+    proxy->forwarded += accepted;
+    proxy->reports.erase(proxy->reports.begin(), proxy->reports.begin() + accepted);
+    if (accepted) openSpool(proxy);
+}
+
+static void upstreamEvent(Proxy *const proxy, const int fd, const uint32_t events) {
+    Upstream &upstream = proxy->upstreams[fd];
+    bool failed = false, closed = false;
+    if (!upstream.connected) {
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size) || error) failed = true;
+        else if (events & EPOLLOUT) upstream.connected = true;
+    }
+    if (!failed && upstream.connected && upstream.sent < upstream.output.size()) {
+        while (upstream.sent < upstream.output.size()) {
+            const ssize_t result = send(fd, upstream.output.data() + upstream.sent, upstream.output.size() - upstream.sent, MSG_NOSIGNAL);
+            if (result < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) failed = true;
+                break;
+            }
+            upstream.sent += result;
+        }
+        if (upstream.sent == upstream.output.size()) watch(*proxy, fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+    }
+    if (!failed && upstream.connected && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        char buffer[65536];
+        ssize_t result;
+        while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) upstream.input.append(buffer, result);
+        if (result == 0) closed = true;
+        else if (errno != EAGAIN && errno != EINTR) failed = true;
+        // the chunk headers come on top of the body
+        if (upstream.input.size() > 2 * MAX_RESPONSE_SIZE) failed = true;
+    }
+    processUpstream(proxy, fd, closed, failed);
+}
+
+// device requests //
+
+static void get(Proxy *const proxy, const int fd, const string &key) {
+    Entry &entry = proxy->entries[key];
+    entry.used = time(nullptr);
+    entry.requested = true;
+    if (entry.cached && entry.used - entry.validated < proxy->options.max_age) {
+        proxy->hits += 1;
+        return reply(proxy, fd, entryResponse(*proxy, key, &entry));
+    }
+    // the origin is down, the devices don't wait for it again until the retry
+    if (entry.cached && entry.failed && monotonic() - entry.failed < RETRY_INTERVAL) {
+        proxy->stale += 1;
+        return reply(proxy, fd, entryResponse(*proxy, key, &entry));
+    }
+
+    Connection &connection = proxy->connections[fd];
+    connection.waiting_for = key;
+    connection.waiting_since = monotonic();
+    entry.waiting.push_back(fd);
+    // the devices asking at once share one fetch
+    if (entry.fetch < 0) fetch(proxy, key, &entry);
+}
+
+// the device is told the report arrived once it is queued, the origin gets it with the next batch
+static void post(Proxy *const proxy, const int fd, string target, const string &body) {
+    if (proxy->reports.size() >= MAX_QUEUED_REPORTS) return reply(proxy, fd, httpResponse(503));
+    // the origin sees the address of the proxy, so the device is named by its own unless its url names it;
+    // the report service takes no colons in names
+    if (!hasParameter(target, "device")) {
+        string name = proxy->connections[fd].address;
+        for (char &c : name) if (c == ':') c = '-';
+        target += (target.find('?') == string::npos ? "?device=" : "&device=") + name;
+    }
+    proxy->reports.push_back({ target, body });
+    if (proxy->spool) {
+        writeReport(proxy->spool, proxy->reports.back());
+        fflush(proxy->spool);
+    }
+    static const shared_ptr<const string> ok = httpResponse(200);
+    reply(proxy, fd, ok);
+}
+
+// handles the request once it is complete
+static void handleInput(Proxy *const proxy, const int fd) {
+    Connection &connection = proxy->connections[fd];
+    if (connection.output || !connection.waiting_for.empty()) return;
+    const size_t header_end = connection.input.find("\r\n\r\n");
+    if (header_end == string::npos) {
+        if (connection.input.size() > MAX_HEADER_SIZE) reply(proxy, fd, httpResponse(400));
+        return;
+    }
+
+    const size_t line_end = connection.input.find("\r\n");
+    const string line = connection.input.substr(0, line_end);
+    const size_t method_end = line.find(' ');
+    const size_t target_end = line.rfind(' ');
+    if (method_end == string::npos || target_end <= method_end + 1 || line[method_end + 1] != '/') return reply(proxy, fd, httpResponse(400));
+    const string method = line.substr(0, method_end);
+    const string target = line.substr(method_end + 1, target_end - method_end - 1);
+
+    long long content_length = -1;
+    string vary;
+    for (size_t start = line_end + 2; start < header_end + 2;) {
+        const size_t end = connection.input.find("\r\n", start);
+        const string field = connection.input.substr(start, end - start);
+        if (!strncasecmp(field.c_str(), "Content-Length:", 15)) content_length = atoll(field.c_str() + 15);
+        else if (!strncasecmp(field.c_str(), "Transfer-Encoding:", 18)) return reply(proxy, fd, httpResponse(400));
+        for (const char *const name : VARY_HEADERS) if (!strncasecmp(field.c_str(), name, strlen(name))) vary += field + "\r\n";
+        start = end + 2;
+    }
+
+    if (method == "GET") return get(proxy, fd, vary.empty() ? target : target + "\n" + vary);
+    if (method != "POST") return reply(proxy, fd, httpResponse(405));
+    if (content_length < 0) return reply(proxy, fd, httpResponse(411));
+    if ((size_t)content_length > MAX_REPORT_SIZE) return reply(proxy, fd, httpResponse(413));
+    const size_t body_start = header_end + 4;
+    if (connection.input.size() < body_start + content_length) return;
+    post(proxy, fd, target, connection.input.substr(body_start, content_length));
+}
+
+static void deviceEvent(Proxy *const proxy, const int fd, const uint32_t events) {
+    Connection &connection = proxy->connections[fd];
+    if (connection.output) {
+        if (events & EPOLLOUT) flushConnection(proxy, fd);
+        else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) closeConnection(proxy, fd);
+        return;
+    }
+    char buffer[4096];
+    ssize_t result;
+    while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) connection.input.append(buffer, result);
+    // a device that gave up waiting closes its side
+    if (result == 0 || (result < 0 && errno != EAGAIN && errno != EINTR)) return closeConnection(proxy, fd);
+    handleInput(proxy, fd);
+}
+
+// timeouts, stale answers, refreshes, evictions and report batches
+static void tick(Proxy *const proxy) {
+    const int64_t now = monotonic();
+    vector<int> late;
+    for (const auto &[fd, upstream] : proxy->upstreams) if (now - upstream.started > ORIGIN_TIMEOUT) late.push_back(fd);
+    for (const int fd : late) processUpstream(proxy, fd, true, true);
+
+    vector<int> stale, idle;
+    for (const auto &[fd, connection] : proxy->connections) {
+        if (now - connection.opened > DEVICE_TIMEOUT) idle.push_back(fd);
+        else if (!connection.waiting_for.empty() && now - connection.waiting_since >= STALE_AFTER) {
+            const auto entry = proxy->entries.find(connection.waiting_for);
+            if (entry != proxy->entries.end() && entry->second.cached) stale.push_back(fd);
+        }
+    }
+    for (const int fd : idle) closeConnection(proxy, fd);
+    for (const int fd : stale) {
+        const string key = proxy->connections[fd].waiting_for;
+        proxy->stale += 1;
+        reply(proxy, fd, entryResponse(*proxy, key, &proxy->entries[key]));
+    }
+
+    if (now - proxy->last_maintenance >= 1000) {
+        proxy->last_maintenance = now;
+        const time_t wall = time(nullptr);
+        vector<string> refresh, evict;
+        for (const auto &[key, entry] : proxy->entries) {
+            if (entry.fetch >= 0 || !entry.waiting.empty()) continue;
+            if (wall - entry.used > EVICT_AGE) evict.push_back(key);
+            // the responses the devices asked for are kept fresh, so the next device doesn't wait for the origin
+            else if (entry.cached && entry.requested && wall - entry.validated >= proxy->options.max_age &&
+                     (!entry.failed || now - entry.failed >= RETRY_INTERVAL)) refresh.push_back(key);
+        }
+        for (const string &key : evict) {
+            unlink(cachePath(*proxy, key).c_str());
+            proxy->entries.erase(key);
+        }
+        for (size_t i = 0; i < refresh.size() && proxy->fetches < MAX_REFRESHES; i += 1) fetch(proxy, refresh[i], &proxy->entries[refresh[i]]);
+    }
+
+    if (!proxy->batch_running && !proxy->reports.empty() &&
+        (proxy->reports.size() >= MAX_BATCH || now - proxy->last_batch >= (int64_t)proxy->options.report_interval * 1000)) sendBatch(proxy);
+}
+
+static bool resolveOrigin(Proxy *const proxy) {
+    string host = proxy->options.origin, port = "80";
+    const size_t colon = host.rfind(':');
+    if (colon != string::npos && host.find(']', colon) == string::npos && (host[0] == '[' || host.find(':') == colon)) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found;
+    const int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+    if (error) {
+        fprintf(stderr, "proxy: %s: %s\n", proxy->options.origin.c_str(), gai_strerror(error));
+        return false;
+    }
+    memcpy(&proxy->origin, found->ai_addr, found->ai_addrlen);
+    proxy->origin_size = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+static int serve(const Options &options) {
+    Proxy proxy;
+    proxy.options = options;
+    if (!resolveOrigin(&proxy)) return 1;
+    const string cache_directory = options.directory + "/" + CACHE_DIRECTORY;
+    for (const string &directory : { options.directory, cache_directory })
+        if (mkdir(directory.c_str(), 0755) && errno != EEXIST) { perror(directory.c_str()); return 1; }
+    loadEntries(&proxy);
+    loadReports(&proxy);
+    if (!openSpool(&proxy)) return 1;
+
+    const int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) { perror("proxy: socket"); return 1; }
+    const int yes = 1, no = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+    sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(options.port);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) || listen(listener, SOMAXCONN)) { perror("proxy: bind"); return 1; }
+
+    proxy.poll = epoll_create1(EPOLL_CLOEXEC);
+    watch(proxy, listener, EPOLLIN, EPOLL_CTL_ADD);
+
+    struct sigaction action = {};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    fprintf(stderr, "proxy: serving %s on port %u, %zu responses cached, %zu reports queued\n", options.origin.c_str(), options.port,
+            proxy.entries.size(), proxy.reports.size());
+
+    epoll_event events[256];
+    bool failed = false;
+    while (!stopping) {
+        const int count = epoll_wait(proxy.poll, events, sizeof(events) / sizeof(*events), TICK);
+        if (count < 0 && errno != EINTR) { perror("proxy: epoll_wait"); failed = true; break; }
+
+        for (int i = 0; i < count; i += 1) {
+            const int fd = events[i].data.fd;
+            if (fd == listener) {
+                sockaddr_in6 peer;
+                socklen_t peer_size = sizeof(peer);
+                int client;
+                while ((client = accept4(listener, (sockaddr *)&peer, &peer_size, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                    Connection &connection = proxy.connections[client];
+                    connection = Connection();
+                    connection.opened = monotonic();
+                    if (IN6_IS_ADDR_V4MAPPED(&peer.sin6_addr)) inet_ntop(AF_INET, &peer.sin6_addr.s6_addr[12], connection.address, sizeof(connection.address));
+                    else inet_ntop(AF_INET6, &peer.sin6_addr, connection.address, sizeof(connection.address));
+                    watch(proxy, client, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+                    peer_size = sizeof(peer);
+                }
+            } else if (proxy.upstreams.count(fd)) upstreamEvent(&proxy, fd, events[i].events);
+            else if (proxy.connections.count(fd)) deviceEvent(&proxy, fd, events[i].events);
+        }
+        tick(&proxy);
+    }
+
+    if (proxy.spool && fclose(proxy.spool)) failed = true;
+    fprintf(stderr, "proxy: %llu hits, %llu stale, %llu fetched, %llu origin failures, %llu reports forwarded, %zu queued\n",
+            (unsigned long long)proxy.hits, (unsigned long long)proxy.stale, (unsigned long long)proxy.misses,
+            (unsigned long long)proxy.failures, (unsigned long long)proxy.forwarded, proxy.reports.size());
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i += 1) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) options.origin = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) options.directory = argv[++i];
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc) options.port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) options.schedule = argv[++i];
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc) options.max_age = strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) options.report_interval = strtoul(argv[++i], nullptr, 10);
+        else {
+            fprintf(stderr, "proxy: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (options.origin.empty()) {
+        fprintf(stderr, "usage: proxy -o host[:port] [-d dir] [-p port] [-s schedule_path] [-m max_age] [-r report_interval]\n");
+        return 1;
+    }
+    return serve(options);
+}
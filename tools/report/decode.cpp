@@ -0,0 +1,102 @@
+#include "decode.h"
+
+#define NAME(type, name) { (uint8_t)type::name, #name }
+// a renamed or removed firmware code breaks the build here, a new one prints as a number until it is named
+const struct { uint8_t value; const char *name; } TYPE_NAMES[] = {
+    NAME(Type, Generic), NAME(Type, DayGeneric), NAME(Type, DayRecent), NAME(Type, DayRand),
+    NAME(Type, NightGeneric), NAME(Type, NightRecent), NAME(Type, NightRand),
+};
+const struct { uint8_t value; const char *name; } RESULT_NAMES[] = {
+    NAME(Result, Ok), NAME(Result, RemoveFailed), NAME(Result, RenameFailed), NAME(Result, WriteFailed),
+    NAME(Result, ClearFailed), NAME(Result, CreateFailed), NAME(Result, ReadOpenFailed), NAME(Result, WriteOpenFailed),
+    NAME(Result, FilesMissing), NAME(Result, StreamReadFailed), NAME(Result, StreamNotConnected),
+    NAME(Result, LimitExceded), NAME(Result, StreamGetFailed), NAME(Result, HttpRequestFailed),
+    NAME(Result, HttpBeginFailed), NAME(Result, WrongLength), NAME(Result, TooLarge), NAME(Result, TooShort),
+    NAME(Result, Empty), NAME(Result, RtcWriteFailed), NAME(Result, RtcReadFailed), NAME(Result, NtpUpdateFailed),
+    NAME(Result, TimeLost), NAME(Result, SdNotConnected), NAME(Result, OutOfMemory), NAME(Result, DeadlineExceeded),
+    NAME(Result, FlashMountFailed), NAME(Result, SdSlow),
+};
+const struct { uint8_t value; const char *name; } OPERATION_NAMES[] = {
+    NAME(SdOperation, Open), NAME(SdOperation, Read), NAME(SdOperation, Write),
+    NAME(SdOperation, Rename), NAME(SdOperation, Remove), NAME(SdOperation, Truncate),
+};
+#undef NAME
+static_assert(sizeof(TYPE_NAMES) / sizeof(*TYPE_NAMES) == (uint8_t)Type::NightRand / 0x20 + 1, "name every Type of storage.h");
+static_assert(sizeof(RESULT_NAMES) / sizeof(*RESULT_NAMES) == (uint8_t)Result::SdSlow + 1, "name every Result of storage.h");
+static_assert(sizeof(OPERATION_NAMES) / sizeof(*OPERATION_NAMES) == SD_OPERATION_COUNT, "name every SdOperation of storage.h");
+// the markers can't be mistaken for errors
+static_assert(((uint8_t)Type::NightRand | (uint8_t)Result::SdSlow) < CLOCK_MARKER, "error codes reach the record markers");
+
+DecodeResult decode(const uint8_t *const body, const size_t size, Report *const report) {
+    *report = Report();
+    if (!size) return DecodeResult::Empty;
+
+    for (size_t i = 0; i < size;) {
+        const uint8_t byte = body[i++];
+        if (byte == BATTERY_MARKER) {
+            if (size - i < 2) return DecodeResult::Truncated;
+            report->has_battery = true;
+            report->charge = body[i] | (body[i + 1] << 8);
+            i += 2;
+        } else if (byte == HEAP_MARKER) {
+            if (size - i < 3) return DecodeResult::Truncated;
+            report->has_heap = true;
+            report->min_free_heap = body[i] | (body[i + 1] << 8);
+            report->max_fragmentation = body[i + 2];
+            i += 3;
+        } else if (byte == SD_MARKER) {
+            if (size - i < SD_COUNT * 2) return DecodeResult::Truncated;
+            report->has_sd = true;
+            for (uint8_t j = 0; j < SD_COUNT; j += 1, i += 2) report->sd_counts[j] = body[i] | (body[i + 1] << 8);
+        } else if (byte == WAKE_MARKER) {
+            if (size - i < 6) return DecodeResult::Truncated;
+            report->has_wakes = true;
+            report->wake_count = body[i] | (body[i + 1] << 8);
+            report->wake_mean_us = body[i + 2] | (body[i + 3] << 8);
+            report->wake_max_us = body[i + 4] | (body[i + 5] << 8);
+            i += 6;
+        } else if (byte == CLOCK_MARKER) {
+            if (size - i < 4) return DecodeResult::Truncated;
+            report->has_clock = true;
+            report->clock_offset_ms = (int32_t)(body[i] | (body[i + 1] << 8) | (body[i + 2] << 16) | ((uint32_t)body[i + 3] << 24));
+            i += 4;
+        } else {
+            if (report->error_count == ERROR_BUFFER_SIZE) return DecodeResult::TooManyErrors;
+            report->errors[report->error_count++] = FullResult(byte);
+        }
+    }
+    return DecodeResult::Ok;
+}
+
+const char *typeName(const uint8_t type) {
+    for (const auto &entry : TYPE_NAMES) if (entry.value == type) return entry.name;
+    return nullptr;
+}
+const char *resultName(const uint8_t result) {
+    for (const auto &entry : RESULT_NAMES) if (entry.value == result) return entry.name;
+    return nullptr;
+}
+const char *operationName(const uint8_t operation) {
+    for (const auto &entry : OPERATION_NAMES) if (entry.value == operation) return entry.name;
+    return nullptr;
+}
+const char *decodeResultName(const DecodeResult result) {
+    switch (result) {
+        case DecodeResult::Ok: return "Ok";
+        case DecodeResult::Empty: return "Empty";
+        case DecodeResult::TooManyErrors: return "TooManyErrors";
+        case DecodeResult::Truncated: return "Truncated";
+    }
+    return nullptr;
+}
+
+const char *chargeLevel(const uint16_t charge) {
+    if (charge < BATTERY_CHARGE_ERROR) return "Error";
+    if (charge < BATTERY_CHARGE_WARNING) return "Warning";
+    if (charge < BATTERY_CHARGE_WEAK) return "Weak";
+    if (charge < BATTERY_CHARGE_LOW) return "Low";
+    return "Full";
+}
+uint16_t bucketLimit(const uint8_t bucket) {
+    return bucket + 1 < SD_LATENCY_BUCKET_COUNT ? 1 << (2 * bucket) : 0;
+}
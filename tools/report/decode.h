@@ -0,0 +1,58 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+// decoding of the bodies the firmware posts to REPORT, the codes and sizes come from src/storage.h
+
+#include "storage.h"
+#include <cstddef>
+#include <cstdint>
+
+const uint8_t BATTERY_MARKER = 255;
+const uint8_t HEAP_MARKER = 254;
+const uint8_t SD_MARKER = 253;
+const uint8_t WAKE_MARKER = 252;
+const uint8_t CLOCK_MARKER = 251;
+const uint8_t SD_COUNT = SD_OPERATION_COUNT * SD_LATENCY_BUCKET_COUNT;
+const uint16_t NO_HEAP = UINT16_MAX;
+const uint8_t NO_FRAGMENTATION = UINT8_MAX;
+
+struct Report {
+    FullResult errors[ERROR_BUFFER_SIZE];
+    uint8_t error_count = 0;
+    bool has_battery = false;
+    uint16_t charge = 0;
+    bool has_heap = false;
+    uint16_t min_free_heap = NO_HEAP;
+    uint8_t max_fragmentation = NO_FRAGMENTATION;
+    bool has_sd = false;
+    uint16_t sd_counts[SD_COUNT] = {};
+    bool has_wakes = false;
+    uint16_t wake_count = 0;
+    uint16_t wake_mean_us = 0;
+    uint16_t wake_max_us = 0;
+    bool has_clock = false;
+    int32_t clock_offset_ms = 0;
+};
+
+enum class DecodeResult : uint8_t {
+    Ok,
+    Empty,
+    TooManyErrors,
+    Truncated,
+};
+
+DecodeResult decode(const uint8_t *const body, const size_t size, Report *const report);
+
+// null for the codes storage.h doesn't define
+const char *typeName(const uint8_t type);
+const char *resultName(const uint8_t result);
+const char *operationName(const uint8_t operation);
+const char *decodeResultName(const DecodeResult result);
+inline uint8_t typeOf(const FullResult error) { return error.value & 0xe0; }
+inline uint8_t resultOf(const FullResult error) { return error.value & 0x1f; }
+// the levels the firmware acts on, from the thresholds of storage.h
+const char *chargeLevel(const uint16_t charge);
+// upper bound of a latency bucket in ms, 0 for the last one
+uint16_t bucketLimit(const uint8_t bucket);
+
+#endif
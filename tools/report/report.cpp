@@ -0,0 +1,606 @@
+// ingests the error and battery reports of the fleet and answers queries over them
+//
+// usage: report serve [-d dir] [-p port]
+//        report decode < body
+//        report errors [-d dir] [-f from] [-t to] [-b code|type|result|device]
+//        report battery [-d dir] [-f from] [-t to] [--fleet] [device]...
+//        report sd [-d dir] [-f from] [-t to] [--devices]
+//        report wakes [-d dir] [-f from] [-t to] [--devices]
+//        report clock [-d dir] [-f from] [-t to] [--devices]
+//        report devices [-d dir]
+//   from and to are dates (2025-01-31), times (2025-01-31T12:00) or unix seconds, all UTC
+//
+// the device is named by the device parameter of the REPORT url (http://host/report?device=kitchen),
+// devices without one are named by their address
+
+#include "decode.h"
+#include "store.h"
+#include <algorithm>
+#include <array>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <set>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+const char DEFAULT_DIRECTORY[] = "reports";
+const uint16_t DEFAULT_PORT = 8080;
+const size_t MAX_HEADER_SIZE = 4096;
+const size_t MAX_BODY_SIZE = 1024;        // B, the firmware posts under 100
+const size_t FLUSH_ROWS = 8192;           // the columns are written out at this many reports
+const int FLUSH_INTERVAL = 1000;          // ms, or when the oldest one waited this long
+const uint32_t DAY = 86400;
+
+struct Options {
+    string directory = DEFAULT_DIRECTORY;
+    uint16_t port = DEFAULT_PORT;
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;
+    string by = "code";
+    bool fleet = false;
+    bool per_device = false;
+    vector<string> devices;
+};
+
+static bool parseTime(const char *const text, uint32_t *const time) {
+    tm parts = {};
+    const char *end = strptime(text, "%Y-%m-%dT%H:%M", &parts);
+    if (!end) end = strptime(text, "%Y-%m-%d", &parts);
+    if (end && !*end) {
+        *time = timegm(&parts);
+        return true;
+    }
+    char *number_end;
+    *time = strtoul(text, &number_end, 10);
+    return *text && !*number_end;
+}
+static const char *formatTime(const uint32_t time) {
+    static char text[24];
+    const time_t seconds = time;
+    tm parts;
+    gmtime_r(&seconds, &parts);
+    strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &parts);
+    return text;
+}
+static const char *deviceName(const Store &store, const uint16_t device) {
+    // a reader may see rows of a device the writer named after the reader loaded the names
+    return device < store.devices.size() ? store.devices[device].c_str() : "?";
+}
+static string codeName(const uint8_t code) {
+    const char *const type = typeName(code & 0xe0);
+    const char *const result = resultName(code & 0x1f);
+    return (type ? string(type) : "Type" + to_string(code >> 5)) + "/" + (result ? string(result) : "Result" + to_string(code & 0x1f));
+}
+
+// the rows are appended in time order, see serve
+static pair<size_t, size_t> timeRange(const Column<uint32_t> &time, const size_t rows, const Options &options) {
+    size_t low = 0, high = rows;
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+        if (time[middle] < options.from) low = middle + 1;
+        else high = middle;
+    }
+    const size_t begin = low;
+    high = rows;
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+        if (time[middle] < options.to) low = middle + 1;
+        else high = middle;
+    }
+    return { begin, low };
+}
+
+// serve //
+
+struct Connection {
+    string input;
+    string output;
+    size_t sent = 0;
+    bool closing = false;
+    char address[INET6_ADDRSTRLEN] = {};
+};
+
+static volatile sig_atomic_t stopping = false;
+static void stop(int) {
+    stopping = true;
+}
+
+// the value of the device parameter, or the empty string
+static string queryDevice(const string &target) {
+    const size_t query = target.find('?');
+    if (query == string::npos) return "";
+    for (size_t start = query + 1; start < target.size();) {
+        size_t end = target.find('&', start);
+        if (end == string::npos) end = target.size();
+        if (!target.compare(start, 7, "device=")) {
+            const string name = target.substr(start + 7, end - start - 7);
+            if (name.empty() || name.size() > MAX_DEVICE_NAME_LENGTH) return "";
+            for (const char c : name) if (!isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.') return "";
+            return name;
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+struct Server {
+    Store *store;
+    uint32_t last_time = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+};
+
+static const char *status(const uint16_t code) {
+    switch (code) {
+        case 200: return "200 OK";
+        case 400: return "400 Bad Request";
+        case 405: return "405 Method Not Allowed";
+        case 411: return "411 Length Required";
+        case 413: return "413 Payload Too Large";
+        case 503: return "503 Service Unavailable";
+    }
+    return "500 Internal Server Error";
+}
+static void respond(Connection *const connection, const uint16_t code) {
+    connection->output += "HTTP/1.1 ";
+    connection->output += status(code);
+    connection->output += connection->closing ? "\r\nConnection: close\r\nContent-Length: 0\r\n\r\n" : "\r\nContent-Length: 0\r\n\r\n";
+}
+
+static uint16_t ingest(Server *const server, const Connection &connection, const string &target, const uint8_t *const body, const size_t size) {
+    Report report;
+    if (decode(body, size, &report) != DecodeResult::Ok) return 400;
+
+    string name = queryDevice(target);
+    if (name.empty()) name = connection.address;
+    const uint32_t device = server->store->device(name.c_str());
+    if (device == UINT32_MAX) return 503;
+
+    // the queries search the time columns, so a clock step back doesn't reorder the rows
+    server->last_time = max(server->last_time, (uint32_t)time(nullptr));
+    server->store->add(server->last_time, device, report);
+    return 200;
+}
+
+// handles the complete requests in the input, false when the connection is to be dropped right away
+static bool handleInput(Server *const server, Connection *const connection) {
+    while (!connection->closing) {
+        const size_t header_end = connection->input.find("\r\n\r\n");
+        if (header_end == string::npos) return connection->input.size() <= MAX_HEADER_SIZE;
+
+        const string header = connection->input.substr(0, header_end + 2);
+        const size_t line_end = header.find("\r\n");
+        const string line = header.substr(0, line_end);
+        const size_t method_end = line.find(' ');
+        const size_t target_end = line.rfind(' ');
+        if (method_end == string::npos || target_end <= method_end) return false;
+        const string method = line.substr(0, method_end);
+        const string target = line.substr(method_end + 1, target_end - method_end - 1);
+        if (line.compare(target_end + 1, string::npos, "HTTP/1.1")) connection->closing = true;
+
+        long long content_length = -1;
+        for (size_t start = line_end + 2; start < header.size();) {
+            const size_t end = header.find("\r\n", start);
+            const string field = header.substr(start, end - start);
+            if (!strncasecmp(field.c_str(), "Content-Length:", 15)) content_length = atoll(field.c_str() + 15);
+            else if (!strncasecmp(field.c_str(), "Transfer-Encoding:", 18)) return false;
+            else if (!strncasecmp(field.c_str(), "Connection:", 11) && strcasestr(field.c_str(), "close")) connection->closing = true;
+            start = end + 2;
+        }
+
+        uint16_t code;
+        size_t consumed = header_end + 4;
+        if (method != "POST") {
+            code = 405;
+            connection->closing = true;
+        } else if (content_length < 0) {
+            code = 411;
+            connection->closing = true;
+        } else if ((size_t)content_length > MAX_BODY_SIZE) {
+            code = 413;
+            connection->closing = true;
+        } else {
+            if (connection->input.size() < consumed + content_length) return true;
+            code = ingest(server, *connection, target, (const uint8_t *)connection->input.data() + consumed, content_length);
+            consumed += content_length;
+        }
+        if (code == 200) server->accepted += 1;
+        else server->rejected += 1;
+        respond(connection, code);
+        connection->input.erase(0, consumed);
+    }
+    return true;
+}
+
+// false when the connection is done
+static bool sendOutput(Connection *const connection, const int fd) {
+    while (connection->sent < connection->output.size()) {
+        const ssize_t result = send(fd, connection->output.data() + connection->sent, connection->output.size() - connection->sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN;
+        }
+        connection->sent += result;
+    }
+    connection->output.clear();
+    connection->sent = 0;
+    return !connection->closing;
+}
+
+static int serve(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, true)) return 1;
+    Server server = { &store };
+
+    const int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) { perror("report: socket"); return 1; }
+    const int yes = 1, no = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+    sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(options.port);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) || listen(listener, SOMAXCONN)) { perror("report: bind"); return 1; }
+
+    const int poll = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = { EPOLLIN, { .fd = listener } };
+    epoll_ctl(poll, EPOLL_CTL_ADD, listener, &event);
+
+    struct sigaction action = {};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    fprintf(stderr, "report: serving %s on port %u\n", options.directory.c_str(), options.port);
+
+    unordered_map<int, Connection> connections;
+    epoll_event events[256];
+    timespec last_flush;
+    clock_gettime(CLOCK_MONOTONIC, &last_flush);
+    bool failed = false;
+    while (!stopping) {
+        const int count = epoll_wait(poll, events, sizeof(events) / sizeof(*events), FLUSH_INTERVAL);
+        if (count < 0 && errno != EINTR) { perror("report: epoll_wait"); failed = true; break; }
+
+        for (int i = 0; i < count; i += 1) {
+            const int fd = events[i].data.fd;
+            if (fd == listener) {
+                sockaddr_in6 peer;
+                socklen_t peer_size = sizeof(peer);
+                int client;
+                while ((client = accept4(listener, (sockaddr *)&peer, &peer_size, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                    Connection &connection = connections[client];
+                    connection = Connection();
+                    if (IN6_IS_ADDR_V4MAPPED(&peer.sin6_addr)) inet_ntop(AF_INET, &peer.sin6_addr.s6_addr[12], connection.address, sizeof(connection.address));
+                    else inet_ntop(AF_INET6, &peer.sin6_addr, connection.address, sizeof(connection.address));
+                    epoll_event client_event = { EPOLLIN | EPOLLRDHUP, { .fd = client } };
+                    epoll_ctl(poll, EPOLL_CTL_ADD, client, &client_event);
+                    peer_size = sizeof(peer);
+                }
+                continue;
+            }
+
+            Connection &connection = connections[fd];
+            bool open = true;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                char buffer[4096];
+                ssize_t result;
+                while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) connection.input.append(buffer, result);
+                if (result < 0 && errno != EAGAIN && errno != EINTR) open = false;
+                if (open && !handleInput(&server, &connection)) open = false;
+                // a client may half close after its request, the response still goes out
+                if (result == 0) connection.closing = true;
+            }
+            if (open) open = sendOutput(&connection, fd);
+            if (open && !connection.output.empty()) {
+                epoll_event client_event = { EPOLLIN | EPOLLOUT | EPOLLRDHUP, { .fd = fd } };
+                epoll_ctl(poll, EPOLL_CTL_MOD, fd, &client_event);
+            }
+            if (!open || (connection.closing && connection.output.empty())) {
+                close(fd);
+                connections.erase(fd);
+            }
+        }
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const int64_t waited = (now.tv_sec - last_flush.tv_sec) * 1000 + (now.tv_nsec - last_flush.tv_nsec) / 1000000;
+        if (store.pendingRows() >= FLUSH_ROWS || (store.pendingRows() && waited >= FLUSH_INTERVAL)) {
+            if (!store.flush()) { failed = true; break; }
+            last_flush = now;
+        } else if (!store.pendingRows()) last_flush = now;
+    }
+
+    if (!store.flush()) failed = true;
+    fprintf(stderr, "report: %llu reports accepted, %llu rejected\n", (unsigned long long)server.accepted, (unsigned long long)server.rejected);
+    return failed ? 1 : 0;
+}
+
+// decode //
+
+static int decodeBody() {
+    vector<uint8_t> body;
+    uint8_t buffer[4096];
+    for (size_t read; (read = fread(buffer, 1, sizeof(buffer), stdin));) body.insert(body.end(), buffer, buffer + read);
+
+    Report report;
+    const DecodeResult result = decode(body.data(), body.size(), &report);
+    if (result != DecodeResult::Ok) {
+        fprintf(stderr, "report: %s\n", decodeResultName(result));
+        return 1;
+    }
+    for (uint8_t i = 0; i < report.error_count; i += 1) printf("error %s\n", codeName(report.errors[i].value).c_str());
+    if (report.has_battery) printf("battery %u %s\n", report.charge, chargeLevel(report.charge));
+    if (report.has_heap) printf("heap %u B free, %u %% fragmented\n", report.min_free_heap, report.max_fragmentation);
+    for (uint8_t operation = 0; report.has_sd && operation < SD_OPERATION_COUNT; operation += 1) {
+        printf("sd %s", operationName(operation));
+        for (uint8_t bucket = 0; bucket < SD_LATENCY_BUCKET_COUNT; bucket += 1)
+            printf(" %u", report.sd_counts[operation * SD_LATENCY_BUCKET_COUNT + bucket]);
+        printf("\n");
+    }
+    if (report.has_wakes) printf("wakes %u, %u us mean, %u us max\n", report.wake_count, report.wake_mean_us, report.wake_max_us);
+    if (report.has_clock) printf("clock %+d ms\n", report.clock_offset_ms);
+    return 0;
+}
+
+// queries //
+
+static int errors(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+
+    // the reports give the devices and the days that were watched
+    const auto [report_begin, report_end] = timeRange(store.reports.time, store.reportRows(), options);
+    if (report_begin == report_end) return 0;
+    set<uint16_t> watched;
+    for (size_t row = report_begin; row < report_end; row += 1) watched.insert(store.reports.device[row]);
+    const uint32_t first = max(options.from, store.reports.time[report_begin]);
+    const uint32_t last = min(options.to, store.reports.time[report_end - 1] + 1);
+    const double device_days = watched.size() * max(1.0, (last - first) / (double)DAY);
+
+    struct Group { uint64_t errors = 0; set<uint16_t> devices; };
+    map<string, Group> groups;
+    const auto [begin, end] = timeRange(store.errors.time, store.errorRows(), options);
+    for (size_t row = begin; row < end; row += 1) {
+        const uint8_t code = store.errors.code[row];
+        const uint16_t device = store.errors.device[row];
+        string key;
+        if (options.by == "type") key = typeName(code & 0xe0) ? typeName(code & 0xe0) : to_string(code >> 5);
+        else if (options.by == "result") key = resultName(code & 0x1f) ? resultName(code & 0x1f) : to_string(code & 0x1f);
+        else if (options.by == "device") key = deviceName(store, device);
+        else key = codeName(code);
+        Group &group = groups[key];
+        group.errors += 1;
+        group.devices.insert(device);
+    }
+
+    vector<pair<string, Group *>> sorted;
+    for (auto &[key, group] : groups) sorted.push_back({ key, &group });
+    stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second->errors > b.second->errors; });
+    printf("%s,errors,devices,errors_per_device_day\n", options.by.c_str());
+    for (const auto &[key, group] : sorted)
+        printf("%s,%llu,%zu,%.4f\n", key.c_str(), (unsigned long long)group->errors, group->devices.size(), group->errors / device_days);
+    return 0;
+}
+
+static int battery(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+    const auto [begin, end] = timeRange(store.battery.time, store.batteryRows(), options);
+
+    if (options.fleet) {
+        // every device counts once a day, with its last charge of the day
+        map<uint32_t, map<uint16_t, uint16_t>> days;
+        for (size_t row = begin; row < end; row += 1) days[store.battery.time[row] / DAY][store.battery.device[row]] = store.battery.charge[row];
+        printf("day,devices,min,median,max,below_warning\n");
+        for (const auto &[day, charges] : days) {
+            vector<uint16_t> sorted;
+            for (const auto &[device, charge] : charges) sorted.push_back(charge);
+            sort(sorted.begin(), sorted.end());
+            const size_t below_warning = lower_bound(sorted.begin(), sorted.end(), BATTERY_CHARGE_WARNING) - sorted.begin();
+            printf("%.10s,%zu,%u,%u,%u,%zu\n", formatTime(day * DAY), sorted.size(), sorted.front(), sorted[sorted.size() / 2],
+                   sorted.back(), below_warning);
+        }
+        return 0;
+    }
+
+    set<uint16_t> selected;
+    for (const string &name : options.devices) {
+        const auto found = find(store.devices.begin(), store.devices.end(), name);
+        if (found == store.devices.end()) { fprintf(stderr, "report: unknown device %s\n", name.c_str()); return 1; }
+        selected.insert(found - store.devices.begin());
+    }
+    map<uint16_t, vector<size_t>> curves;
+    for (size_t row = begin; row < end; row += 1) {
+        const uint16_t device = store.battery.device[row];
+        if (selected.empty() || selected.count(device)) curves[device].push_back(row);
+    }
+    printf("device,time,charge,level,min_free_heap,max_fragmentation\n");
+    for (const auto &[device, rows] : curves) {
+        for (const size_t row : rows) {
+            const uint16_t charge = store.battery.charge[row];
+            printf("%s,%s,%u,%s,", deviceName(store, device), formatTime(store.battery.time[row]), charge, chargeLevel(charge));
+            const uint16_t heap = store.battery.min_free_heap[row];
+            const uint8_t fragmentation = store.battery.max_fragmentation[row];
+            if (heap == NO_HEAP) printf(",\n");
+            else printf("%u,%u\n", heap, fragmentation);
+        }
+    }
+    return 0;
+}
+
+static int sd(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+    const auto [begin, end] = timeRange(store.sd.time, store.sdRows(), options);
+
+    map<uint16_t, array<uint64_t, SD_COUNT>> totals;
+    for (size_t row = begin; row < end; row += 1) {
+        const SdCounts counts = store.sd.counts[row];
+        array<uint64_t, SD_COUNT> &total = totals[options.per_device ? store.sd.device[row] : 0];
+        for (uint8_t i = 0; i < SD_COUNT; i += 1) total[i] += counts.counts[i];
+    }
+
+    if (options.per_device) printf("device,");
+    printf("operation");
+    for (uint8_t bucket = 0; bucket < SD_LATENCY_BUCKET_COUNT; bucket += 1) {
+        if (bucketLimit(bucket)) printf(",under_%ums", bucketLimit(bucket));
+        else printf(",over_%ums", bucketLimit(bucket - 1));
+    }
+    printf(",slow_share\n");
+    for (const auto &[device, total] : totals) {
+        for (uint8_t operation = 0; operation < SD_OPERATION_COUNT; operation += 1) {
+            if (options.per_device) printf("%s,", deviceName(store, device));
+            printf("%s", operationName(operation));
+            uint64_t count = 0, slow = 0;
+            for (uint8_t bucket = 0; bucket < SD_LATENCY_BUCKET_COUNT; bucket += 1) {
+                const uint64_t value = total[operation * SD_LATENCY_BUCKET_COUNT + bucket];
+                printf(",%llu", (unsigned long long)value);
+                count += value;
+                if (bucket >= SD_SLOW_BUCKET) slow += value;
+            }
+            printf(",%.4f\n", count ? slow / (double)count : 0.0);
+        }
+    }
+    return 0;
+}
+
+// the awake time of the idle wakes, of the fleet or of every device
+static int wakes(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+    const auto [begin, end] = timeRange(store.wakes.time, store.wakeRows(), options);
+
+    struct Total { uint64_t count = 0; uint64_t total_us = 0; uint16_t max_us = 0; };
+    map<uint16_t, Total> totals;
+    for (size_t row = begin; row < end; row += 1) {
+        Total &total = totals[options.per_device ? store.wakes.device[row] : 0];
+        const uint16_t count = store.wakes.count[row];
+        total.count += count;
+        total.total_us += (uint64_t)count * store.wakes.mean_us[row];
+        if (count) total.max_us = max(total.max_us, store.wakes.max_us[row]);
+    }
+
+    if (options.per_device) printf("device,");
+    printf("wakes,mean_us,max_us\n");
+    for (const auto &[device, total] : totals) {
+        if (options.per_device) printf("%s,", deviceName(store, device));
+        printf("%llu,%llu,%u\n", (unsigned long long)total.count, (unsigned long long)(total.count ? total.total_us / total.count : 0), total.max_us);
+    }
+    return 0;
+}
+
+// the rtc drift measured at the battery reports, a device whose wakes miss the windows drifts far
+static int drift(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+    const auto [begin, end] = timeRange(store.clock.time, store.clockRows(), options);
+
+    struct Total { uint64_t count = 0; int64_t total_ms = 0; int32_t min_ms = INT32_MAX; int32_t max_ms = INT32_MIN; };
+    map<uint16_t, Total> totals;
+    for (size_t row = begin; row < end; row += 1) {
+        Total &total = totals[options.per_device ? store.clock.device[row] : 0];
+        const int32_t offset = store.clock.offset_ms[row];
+        total.count += 1;
+        total.total_ms += offset;
+        total.min_ms = min(total.min_ms, offset);
+        total.max_ms = max(total.max_ms, offset);
+    }
+
+    if (options.per_device) printf("device,");
+    printf("reports,mean_ms,min_ms,max_ms\n");
+    for (const auto &[device, total] : totals) {
+        if (options.per_device) printf("%s,", deviceName(store, device));
+        printf("%llu,%lld,%d,%d\n", (unsigned long long)total.count, (long long)(total.total_ms / (int64_t)total.count), total.min_ms, total.max_ms);
+    }
+    return 0;
+}
+
+static int devices(const Options &options) {
+    Store store;
+    if (!store.open(options.directory, false)) return 1;
+
+    struct Summary { uint32_t first_seen = UINT32_MAX; uint32_t last_seen = 0; uint64_t reports = 0; uint64_t errors = 0; int32_t charge = -1; };
+    vector<Summary> summaries(store.devices.size());
+    for (size_t row = 0; row < store.reportRows(); row += 1) {
+        const uint16_t device = store.reports.device[row];
+        if (device >= summaries.size()) continue;
+        Summary &summary = summaries[device];
+        summary.first_seen = min(summary.first_seen, store.reports.time[row]);
+        summary.last_seen = max(summary.last_seen, store.reports.time[row]);
+        summary.reports += 1;
+        summary.errors += store.reports.error_count[row];
+    }
+    for (size_t row = 0; row < store.batteryRows(); row += 1) {
+        const uint16_t device = store.battery.device[row];
+        if (device < summaries.size()) summaries[device].charge = store.battery.charge[row];
+    }
+
+    printf("device,first_seen,last_seen,reports,errors,charge\n");
+    for (size_t device = 0; device < summaries.size(); device += 1) {
+        const Summary &summary = summaries[device];
+        if (!summary.reports) continue;
+        printf("%s,%s,", store.devices[device].c_str(), formatTime(summary.first_seen));
+        printf("%s,%llu,%llu,", formatTime(summary.last_seen), (unsigned long long)summary.reports, (unsigned long long)summary.errors);
+        if (summary.charge < 0) printf("\n");
+        else printf("%d\n", summary.charge);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: report serve|decode|errors|battery|sd|wakes|clock|devices [options]\n");
+        return 1;
+    }
+    const string command = argv[1];
+    Options options;
+    for (int i = 2; i < argc; i += 1) {
+        if (!strcmp(argv[i], "-d") && i + 1 < argc) options.directory = argv[++i];
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc) options.port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) options.by = argv[++i];
+        else if (!strcmp(argv[i], "--fleet")) options.fleet = true;
+        else if (!strcmp(argv[i], "--devices")) options.per_device = true;
+        else if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "-t")) && i + 1 < argc) {
+            uint32_t *const time = argv[i][1] == 'f' ? &options.from : &options.to;
+            if (!parseTime(argv[++i], time)) {
+                fprintf(stderr, "report: bad time %s\n", argv[i]);
+                return 1;
+            }
+        } else if (argv[i][0] != '-') options.devices.push_back(argv[i]);
+        else {
+            fprintf(stderr, "report: bad argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (options.by != "code" && options.by != "type" && options.by != "result" && options.by != "device") {
+        fprintf(stderr, "report: bad grouping %s\n", options.by.c_str());
+        return 1;
+    }
+
+    if (command == "serve") return serve(options);
+    if (command == "decode") return decodeBody();
+    if (command == "errors") return errors(options);
+    if (command == "battery") return battery(options);
+    if (command == "sd") return sd(options);
+    if (command == "wakes") return wakes(options);
+    if (command == "clock") return drift(options);
+    if (command == "devices") return devices(options);
+    fprintf(stderr, "report: unknown command %s\n", command.c_str());
+    return 1;
+}
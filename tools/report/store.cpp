@@ -0,0 +1,170 @@
+#include "store.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ColumnFile::~ColumnFile() {
+    if (data) munmap((void *)data, size);
+    if (fd >= 0) close(fd);
+}
+
+bool ColumnFile::open(const string &directory, const bool writable) {
+    const string path = directory + "/" + name;
+    fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        // a store nothing was written to yet reads as empty
+        if (!writable && errno == ENOENT) return true;
+        perror(path.c_str());
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status)) { perror(path.c_str()); return false; }
+    size = status.st_size;
+    if (writable || !size) return true;
+
+    data = (const uint8_t *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        perror(path.c_str());
+        return false;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    return true;
+}
+size_t ColumnFile::rows() const {
+    return size / width;
+}
+bool ColumnFile::truncate(const size_t rows) {
+    if (rows * width == size) return true;
+    if (ftruncate(fd, rows * width)) { perror(name); return false; }
+    size = rows * width;
+    return true;
+}
+void ColumnFile::put(const void *const value) {
+    pending.insert(pending.end(), (const uint8_t *)value, (const uint8_t *)value + width);
+}
+bool ColumnFile::flush() {
+    size_t written = 0;
+    while (written < pending.size()) {
+        const ssize_t result = write(fd, pending.data() + written, pending.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            perror(name);
+            // the rows written so far stay, the table is cut back to its shortest column on the next open
+            pending.erase(pending.begin(), pending.begin() + written);
+            size += written;
+            return false;
+        }
+        written += result;
+    }
+    size += written;
+    pending.clear();
+    return true;
+}
+
+Store::Store() {
+    report_columns = { &reports.time, &reports.device, &reports.error_count, &reports.records };
+    error_columns = { &errors.time, &errors.device, &errors.code };
+    battery_columns = { &battery.time, &battery.device, &battery.charge, &battery.min_free_heap, &battery.max_fragmentation };
+    sd_columns = { &sd.time, &sd.device, &sd.counts };
+    wake_columns = { &wakes.time, &wakes.device, &wakes.count, &wakes.mean_us, &wakes.max_us };
+    clock_columns = { &clock.time, &clock.device, &clock.offset_ms };
+}
+
+size_t Store::rows(const vector<ColumnFile *> &columns) {
+    size_t rows = SIZE_MAX;
+    for (const ColumnFile *const column : columns) rows = min(rows, column->rows());
+    return rows;
+}
+bool Store::openTable(const vector<ColumnFile *> &columns, const bool writable) {
+    for (ColumnFile *const column : columns) if (!column->open(directory, writable)) return false;
+    if (!writable) return true;
+    const size_t complete = rows(columns);
+    for (ColumnFile *const column : columns) if (!column->truncate(complete)) return false;
+    return true;
+}
+
+bool Store::open(const string &directory, const bool writable) {
+    this->directory = directory;
+    if (writable && mkdir(directory.c_str(), 0755) && errno != EEXIST) { perror(directory.c_str()); return false; }
+
+    const string path = directory + "/" + DEVICES_FILE;
+    FILE *const file = fopen(path.c_str(), "r");
+    if (file) {
+        char line[MAX_DEVICE_NAME_LENGTH + 2];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\n")] = 0;
+            device_ids[line] = devices.size();
+            devices.push_back(line);
+        }
+        fclose(file);
+    }
+    if (writable && !(devices_file = fopen(path.c_str(), "a"))) { perror(path.c_str()); return false; }
+
+    return openTable(report_columns, writable) && openTable(error_columns, writable) &&
+           openTable(battery_columns, writable) && openTable(sd_columns, writable) && openTable(wake_columns, writable) &&
+           openTable(clock_columns, writable);
+}
+
+uint32_t Store::device(const char *const name) {
+    const auto found = device_ids.find(name);
+    if (found != device_ids.end()) return found->second;
+    if (devices.size() >= MAX_DEVICE_COUNT) return UINT32_MAX;
+
+    // the rows only hold the index, so the name is on disk before any of them
+    fprintf(devices_file, "%s\n", name);
+    fflush(devices_file);
+    device_ids[name] = devices.size();
+    devices.push_back(name);
+    return devices.size() - 1;
+}
+
+void Store::add(const uint32_t time, const uint16_t device, const Report &report) {
+    reports.time.push(time);
+    reports.device.push(device);
+    reports.error_count.push(report.error_count);
+    reports.records.push((report.has_battery ? BATTERY_RECORD : 0) | (report.has_heap ? HEAP_RECORD : 0) | (report.has_sd ? SD_RECORD : 0) |
+                         (report.has_wakes ? WAKE_RECORD : 0) | (report.has_clock ? CLOCK_RECORD : 0));
+
+    for (uint8_t i = 0; i < report.error_count; i += 1) {
+        errors.time.push(time);
+        errors.device.push(device);
+        errors.code.push(report.errors[i].value);
+    }
+    if (report.has_battery) {
+        battery.time.push(time);
+        battery.device.push(device);
+        battery.charge.push(report.charge);
+        battery.min_free_heap.push(report.min_free_heap);
+        battery.max_fragmentation.push(report.max_fragmentation);
+    }
+    if (report.has_sd) {
+        SdCounts counts;
+        memcpy(counts.counts, report.sd_counts, sizeof(counts.counts));
+        sd.time.push(time);
+        sd.device.push(device);
+        sd.counts.push(counts);
+    }
+    if (report.has_wakes) {
+        wakes.time.push(time);
+        wakes.device.push(device);
+        wakes.count.push(report.wake_count);
+        wakes.mean_us.push(report.wake_mean_us);
+        wakes.max_us.push(report.wake_max_us);
+    }
+    if (report.has_clock) {
+        clock.time.push(time);
+        clock.device.push(device);
+        clock.offset_ms.push(report.clock_offset_ms);
+    }
+}
+
+bool Store::flush() {
+    bool success = true;
+    for (const vector<ColumnFile *> *const columns : { &report_columns, &error_columns, &battery_columns, &sd_columns, &wake_columns, &clock_columns })
+        for (ColumnFile *const column : *columns) if (!column->flush()) success = false;
+    return success;
+}
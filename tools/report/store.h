@@ -0,0 +1,150 @@
+#ifndef STORE_H
+#define STORE_H
+
+// the decoded reports on disk, one append-only file of fixed size values per column
+//
+// a table is as long as its shortest column, so a write torn by a crash loses the last rows only,
+// the writer cuts the longer columns back when it opens the store
+
+#include "decode.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class ColumnFile {
+    public:
+        ColumnFile(const char *const name, const size_t width) : name(name), width(width) {}
+        ColumnFile(const ColumnFile &) = delete;
+        ~ColumnFile();
+        bool open(const string &directory, const bool writable);
+        size_t rows() const;
+        bool truncate(const size_t rows);
+        bool flush();
+        size_t pendingRows() const { return pending.size() / width; }
+
+        const char *const name;
+        const size_t width;
+    protected:
+        void put(const void *const value);
+        const uint8_t *data = nullptr; // mapped for reading
+    private:
+        int fd = -1;
+        size_t size = 0;
+        vector<uint8_t> pending;
+};
+
+template <typename T>
+class Column : public ColumnFile {
+    public:
+        explicit Column(const char *const name) : ColumnFile(name, sizeof(T)) {}
+        void push(const T &value) { put(&value); }
+        T operator[](const size_t row) const {
+            T value;
+            memcpy(&value, data + row * sizeof(T), sizeof(T));
+            return value;
+        }
+};
+
+struct SdCounts {
+    uint16_t counts[SD_COUNT];
+};
+
+// every post
+struct ReportTable {
+    Column<uint32_t> time{ "reports.time" };
+    Column<uint16_t> device{ "reports.device" };
+    Column<uint8_t> error_count{ "reports.error_count" };
+    Column<uint8_t> records{ "reports.records" };
+};
+const uint8_t BATTERY_RECORD = 0x01;
+const uint8_t HEAP_RECORD = 0x02;
+const uint8_t SD_RECORD = 0x04;
+const uint8_t WAKE_RECORD = 0x08;
+const uint8_t CLOCK_RECORD = 0x10;
+
+struct ErrorTable {
+    Column<uint32_t> time{ "errors.time" };
+    Column<uint16_t> device{ "errors.device" };
+    Column<uint8_t> code{ "errors.code" };
+};
+
+// the heap columns hold NO_HEAP and NO_FRAGMENTATION when the firmware didn't send them
+struct BatteryTable {
+    Column<uint32_t> time{ "battery.time" };
+    Column<uint16_t> device{ "battery.device" };
+    Column<uint16_t> charge{ "battery.charge" };
+    Column<uint16_t> min_free_heap{ "battery.min_free_heap" };
+    Column<uint8_t> max_fragmentation{ "battery.max_fragmentation" };
+};
+
+struct SdTable {
+    Column<uint32_t> time{ "sd.time" };
+    Column<uint16_t> device{ "sd.device" };
+    Column<SdCounts> counts{ "sd.counts" };
+};
+
+// the idle wakes between two battery reports
+struct WakeTable {
+    Column<uint32_t> time{ "wakes.time" };
+    Column<uint16_t> device{ "wakes.device" };
+    Column<uint16_t> count{ "wakes.count" };
+    Column<uint16_t> mean_us{ "wakes.mean_us" };
+    Column<uint16_t> max_us{ "wakes.max_us" };
+};
+
+// the rtc drift over the sleep before a battery report, measured against ntp
+struct ClockTable {
+    Column<uint32_t> time{ "clock.time" };
+    Column<uint16_t> device{ "clock.device" };
+    Column<int32_t> offset_ms{ "clock.offset_ms" };
+};
+
+const char DEVICES_FILE[] = "devices";
+const size_t MAX_DEVICE_COUNT = UINT16_MAX;
+const size_t MAX_DEVICE_NAME_LENGTH = 63;
+
+class Store {
+    public:
+        Store();
+        // the reader maps the columns as they are, the writer repairs torn rows and appends
+        bool open(const string &directory, const bool writable);
+        // UINT32_MAX once MAX_DEVICE_COUNT devices are known
+        uint32_t device(const char *const name);
+        void add(const uint32_t time, const uint16_t device, const Report &report);
+        bool flush();
+        size_t pendingRows() const { return reports.time.pendingRows(); }
+
+        size_t reportRows() const { return rows(report_columns); }
+        size_t errorRows() const { return rows(error_columns); }
+        size_t batteryRows() const { return rows(battery_columns); }
+        size_t sdRows() const { return rows(sd_columns); }
+        size_t wakeRows() const { return rows(wake_columns); }
+        size_t clockRows() const { return rows(clock_columns); }
+
+        ReportTable reports;
+        ErrorTable errors;
+        BatteryTable battery;
+        SdTable sd;
+        WakeTable wakes;
+        ClockTable clock;
+        vector<string> devices;
+    private:
+        static size_t rows(const vector<ColumnFile *> &columns);
+        bool openTable(const vector<ColumnFile *> &columns, const bool writable);
+
+        string directory;
+        FILE *devices_file = nullptr;
+        unordered_map<string, uint16_t> device_ids;
+        vector<ColumnFile *> report_columns;
+        vector<ColumnFile *> error_columns;
+        vector<ColumnFile *> battery_columns;
+        vector<ColumnFile *> sd_columns;
+        vector<ColumnFile *> wake_columns;
+        vector<ColumnFile *> clock_columns;
+};
+
+#endif
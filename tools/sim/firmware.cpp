@@ -0,0 +1,18 @@
+// the firmware as one translation unit, so a simulated boot can reset its statics like a real one does
+
+#include "storage.cpp"
+#include "deadline.cpp"
+#include "epd.cpp"
+#include "server_access.cpp"
+#include "main.cpp"
+
+void bootFirmware() {
+    deadline = 0;
+    transfer_bytes = 0;
+    transfer_us = 0;
+    transfer_failed = false;
+    tiles_replaced = false;
+    refreshing = false;
+    sd_stats_loaded = false;
+    sd_stats_changed = false;
+}
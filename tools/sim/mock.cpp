@@ -0,0 +1,620 @@
+// the esp8266 core, the sd card, the panel, the radio and the servers as seen by the firmware
+
+#include "world.h"
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <SD.h>
+#include <SPI.h>
+#include <WiFiClient.h>
+#include "http.h"
+#include "server_access.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+World world;
+EspClass ESP;
+EEPROMClass EEPROM;
+SPIClass SPI;
+ESP8266WiFiClass WiFi;
+SDClass SD(&world.sd);
+fs::FS LittleFS(&world.flash);
+
+const uint8_t PANEL_BUSY_PIN = D1;
+const uint8_t PANEL_DC_PIN = D3;
+const uint16_t IMAGE_WIDTH = 300;  // bytes
+const uint16_t IMAGE_HEIGHT = 448;
+
+// world //
+
+void World::advance(const double us, const double extra_ma) {
+    double ma = config.cpu_ma + extra_ma;
+    if (wifi_on) ma += config.wifi_ma * (0.5 + 0.5 * tx_power / 20.5);
+    if (clock_us < busy_until) ma += config.panel_ma;
+    const double mah = ma * us / 3600e6;
+    metrics.energy_mah += mah;
+    remaining_mah -= mah;
+    clock_us += us;
+}
+bool World::chance(const double probability) {
+    return uniform_real_distribution<double>(0, 1)(rng) < probability;
+}
+uint64_t World::epochUs() const {
+    return start_epoch * 1000000 + wall_us + clock_us;
+}
+uint32_t World::night() const {
+    return (epochUs() / 1000000 - start_epoch) / 86400;
+}
+
+// core //
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i += 1) if (!write(buffer[i])) return i;
+    return size;
+}
+size_t Stream::readBytes(uint8_t *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        const int data = read();
+        if (data < 0) break;
+        buffer[count++] = data;
+    }
+    return count;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(world.rtc)) return false;
+    memcpy(data, world.rtc + offset * 4, size);
+    return true;
+}
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(world.rtc)) return false;
+    memcpy(world.rtc + offset * 4, data, size);
+    return true;
+}
+void EspClass::deepSleep(uint64_t time_us) {
+    throw DeepSleep{ time_us };
+}
+uint32_t EspClass::getFreeHeap() {
+    return 40000;
+}
+uint8_t EspClass::getHeapFragmentation() {
+    return 0;
+}
+
+unsigned long millis() {
+    return world.clock_us / 1000;
+}
+unsigned long micros() {
+    return world.clock_us;
+}
+void delay(unsigned long ms) {
+    world.advance(ms * 1000.0);
+}
+void yield() {
+    world.advance(5);
+}
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin == PANEL_DC_PIN) world.panel_command = value == LOW;
+}
+int digitalRead(uint8_t pin) {
+    if (pin == PANEL_BUSY_PIN) return world.clock_us >= world.busy_until;
+    return LOW;
+}
+int analogRead(uint8_t pin) {
+    // the firmware thresholds are fractions of 255
+    return max(0.0, 255 * world.remaining_mah / world.config.battery_mah);
+}
+char *utoa(unsigned value, char *buffer, int base) {
+    sprintf(buffer, base == 16 ? "%x" : "%u", value);
+    return buffer;
+}
+
+void configTime(int, int, const char *, const char *, const char *) {
+    if (world.wifi_on && world.wifi_link) world.ntp_at = world.clock_us + world.config.ntp_ms * 1000;
+}
+int simGettimeofday(struct timeval *tv, void *) {
+    // the clock starts at zero after boot until sntp sets it
+    const uint64_t now = world.clock_us >= world.ntp_at ? world.epochUs() : world.clock_us;
+    tv->tv_sec = now / 1000000;
+    tv->tv_usec = now % 1000000;
+    return 0;
+}
+
+// eeprom //
+
+void EEPROMClass::begin(size_t size) {
+    this->size = min(size, sizeof(data));
+    memcpy(data, world.eeprom, sizeof(data));
+    dirty = false;
+}
+uint8_t EEPROMClass::read(int address) {
+    return (size_t)address < size ? data[address] : 0;
+}
+void EEPROMClass::write(int address, uint8_t value) {
+    if ((size_t)address >= size || data[address] == value) return;
+    data[address] = value;
+    dirty = true;
+}
+bool EEPROMClass::commit() {
+    if (dirty) {
+        memcpy(world.eeprom, data, size);
+        world.advance(10000);
+    }
+    dirty = false;
+    return true;
+}
+bool EEPROMClass::end() {
+    const bool result = commit();
+    size = 0;
+    return result;
+}
+
+// files //
+
+namespace fs {
+
+struct FileImpl {
+    MemoryFs *fs;
+    string name;
+    shared_ptr<vector<uint8_t>> data;
+    size_t position = 0;
+    bool writable = false;
+    bool append = false;
+    bool directory = false;
+    vector<string> listing;
+    size_t next = 0;
+};
+
+static void charge(MemoryFs *const fs, const double ops, const size_t bytes) {
+    if (fs->sd) {
+        world.metrics.sd_ops += ops;
+        world.metrics.sd_bytes += bytes;
+        world.advance(ops * world.config.sd_op_ms * 1000 + bytes * 1e6 / world.config.sd_rate, world.config.sd_ma);
+    } else {
+        world.metrics.flash_ops += ops;
+        world.advance(ops * world.config.flash_op_ms * 1000 + bytes * 1e6 / world.config.flash_rate);
+    }
+}
+static string key(const char *path) {
+    return path[0] == '/' ? string(path + 1) : string(path);
+}
+
+size_t File::write(uint8_t data) {
+    return write(&data, 1);
+}
+size_t File::write(const uint8_t *buffer, size_t size) {
+    if (!impl || !impl->writable) return 0;
+    vector<uint8_t> &data = *impl->data;
+    if (impl->append) impl->position = data.size();
+    if (data.size() < impl->position + size) data.resize(impl->position + size);
+    memcpy(data.data() + impl->position, buffer, size);
+    impl->position += size;
+    charge(impl->fs, 0, size);
+    return size;
+}
+int File::available() {
+    if (!impl || impl->directory) return 0;
+    return impl->data->size() - min(impl->position, impl->data->size());
+}
+int File::read() {
+    uint8_t data;
+    return read(&data, 1) == 1 ? data : -1;
+}
+int File::peek() {
+    if (!available()) return -1;
+    return (*impl->data)[impl->position];
+}
+size_t File::read(uint8_t *buffer, size_t size) {
+    const size_t count = min(size, (size_t)available());
+    if (!count) return 0;
+    memcpy(buffer, impl->data->data() + impl->position, count);
+    impl->position += count;
+    charge(impl->fs, 0, count);
+    return count;
+}
+bool File::seek(uint32_t position) {
+    if (!impl || position > impl->data->size()) return false;
+    impl->position = position;
+    charge(impl->fs, 0.25, 0);
+    return true;
+}
+size_t File::position() const {
+    return impl ? impl->position : 0;
+}
+size_t File::size() const {
+    return impl && !impl->directory ? impl->data->size() : 0;
+}
+bool File::truncate(uint32_t size) {
+    if (!impl || !impl->writable) return false;
+    impl->data->resize(size);
+    impl->position = min(impl->position, (size_t)size);
+    charge(impl->fs, 1, 0);
+    return true;
+}
+void File::close() {
+    if (impl && impl->writable) charge(impl->fs, 1, 0);
+    impl.reset();
+}
+const char *File::name() const {
+    return impl ? impl->name.c_str() : "";
+}
+bool File::isDirectory() const {
+    return impl && impl->directory;
+}
+File File::openNextFile() {
+    if (!impl || !impl->directory) return File();
+    while (impl->next < impl->listing.size()) {
+        const string &name = impl->listing[impl->next++];
+        auto found = impl->fs->files.find(name);
+        if (found == impl->fs->files.end()) continue;
+        charge(impl->fs, 0.25, 0);
+        auto file = make_shared<FileImpl>();
+        *file = { impl->fs, name, found->second };
+        return File(file);
+    }
+    return File();
+}
+
+bool FS::begin() {
+    fs->mounted = true;
+    charge(fs, 1, 0);
+    return true;
+}
+void FS::end() {
+    fs->mounted = false;
+}
+File FS::open(const char *path, const char *mode) {
+    if (!fs->mounted) return File();
+    charge(fs, 1, 0);
+    auto file = make_shared<FileImpl>();
+    file->fs = fs;
+    if (!strcmp(path, "/")) {
+        file->directory = true;
+        for (const auto &entry : fs->files) file->listing.push_back(entry.first);
+        return File(file);
+    }
+    const string name = key(path);
+    auto found = fs->files.find(name);
+    if (mode[0] == 'r') {
+        if (found == fs->files.end()) return File();
+        *file = { fs, name, found->second };
+        return File(file);
+    }
+    auto data = found == fs->files.end() ? make_shared<vector<uint8_t>>() : found->second;
+    if (mode[0] == 'w') data->clear();
+    fs->files[name] = data;
+    *file = { fs, name, data, mode[0] == 'a' ? data->size() : 0, true, mode[0] == 'a' };
+    return File(file);
+}
+bool FS::exists(const char *path) {
+    if (!fs->mounted) return false;
+    charge(fs, 1, 0);
+    return fs->files.count(key(path));
+}
+bool FS::remove(const char *path) {
+    if (!fs->mounted) return false;
+    charge(fs, 1, 0);
+    return fs->files.erase(key(path));
+}
+bool FS::rename(const char *from, const char *to) {
+    if (!fs->mounted) return false;
+    charge(fs, 1, 0);
+    auto found = fs->files.find(key(from));
+    if (found == fs->files.end() || fs->files.count(key(to))) return false;
+    fs->files[key(to)] = found->second;
+    fs->files.erase(found);
+    return true;
+}
+
+} // namespace fs
+
+bool SDClass::begin(uint8_t) {
+    return fs::FS::begin();
+}
+File SDClass::open(const char *path, uint8_t mode) {
+    return fs::FS::open(path, mode == FILE_WRITE ? "a" : "r");
+}
+
+// panel //
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    writeBytes(&data, 1);
+    return 0;
+}
+void SPIClass::writeBytes(const uint8_t *data, uint32_t size) {
+    world.advance(size * 4.0); // 2 MHz
+    if (world.panel_command) {
+        world.command = data[size - 1];
+        world.data_index = 0;
+        if (world.command != 0x12) return;
+
+        world.metrics.refreshes += 1;
+        world.busy_until = world.clock_us + world.config.refresh_ms * 1000;
+        // the first bytes of every served image carry its id
+        uint32_t id = 0;
+        for (uint8_t i = 0; i < 4; i += 1) {
+            if ((world.marker[i] >> 4) > 6 || (world.marker[i] & 0x0f) > 6 || world.marker[4 + i] != 0x06) return;
+            id = id * 49 + (world.marker[i] >> 4) * 7 + (world.marker[i] & 0x0f);
+        }
+        if (!id) return;
+        const double hour = (world.epochUs() / 1000000 % 86400) / 3600.0;
+        if (hour < 3) world.displayed[world.night()] = id;
+        if (!world.shown.insert(id).second) world.metrics.repeats += 1;
+        return;
+    }
+    if (world.command != 0x10) return;
+    for (uint32_t i = 0; i < size && world.data_index < sizeof(world.marker); i += 1) world.marker[world.data_index++] = data[i];
+}
+
+// radio //
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+    world.wifi_on = mode != WIFI_OFF;
+    return true;
+}
+void ESP8266WiFiClass::begin(const char *, const char *) {
+    world.wifi_on = true;
+    world.wifi_link = world.chance(world.config.connect_probability);
+    const double connect_ms = exponential_distribution<double>(1 / world.config.connect_ms)(world.rng);
+    world.wifi_connected_at = world.clock_us + connect_ms * 1000;
+    world.metrics.wifi_sessions += 1;
+}
+int8_t ESP8266WiFiClass::waitForConnectResult(unsigned long timeout_ms) {
+    const uint64_t timeout_at = world.clock_us + (uint64_t)timeout_ms * 1000;
+    if (world.wifi_link && world.wifi_connected_at <= timeout_at) {
+        if (world.clock_us < world.wifi_connected_at) world.advance(world.wifi_connected_at - world.clock_us);
+        return WL_CONNECTED;
+    }
+    world.advance(timeout_at - world.clock_us);
+    return WL_DISCONNECTED;
+}
+int32_t ESP8266WiFiClass::RSSI() {
+    return world.config.rssi + normal_distribution<double>(0, 3)(world.rng);
+}
+bool ESP8266WiFiClass::disconnect() {
+    world.wifi_link = false;
+    return true;
+}
+void ESP8266WiFiClass::setOutputPower(float dbm) {
+    world.tx_power = dbm;
+}
+
+int WiFiClient::available() {
+    return body.size() - position;
+}
+int WiFiClient::read() {
+    uint8_t data;
+    return read(&data, 1) == 1 ? data : -1;
+}
+int WiFiClient::read(uint8_t *buffer, size_t size) {
+    const size_t count = min(size, body.size() - position);
+    memcpy(buffer, body.data() + position, count);
+    position += count;
+    world.metrics.bytes_downloaded += count;
+    world.advance(count * 1e6 / world.config.throughput);
+    return count;
+}
+int WiFiClient::peek() {
+    return position < body.size() ? body[position] : -1;
+}
+uint8_t WiFiClient::connected() {
+    return position < body.size();
+}
+void WiFiClient::stop() {
+    body.clear();
+    position = 0;
+}
+
+// servers //
+
+static void appendImage(vector<uint8_t> *const body, const uint32_t id, const uint16_t width = IMAGE_WIDTH) {
+    const uint8_t size[4] = { IMAGE_HEIGHT & 0xff, IMAGE_HEIGHT >> 8, (uint8_t)(width & 0xff), (uint8_t)(width >> 8) };
+    body->insert(body->end(), size, size + 4);
+    const size_t start = body->size();
+    body->resize(start + width * IMAGE_HEIGHT, 0x11);
+    uint32_t digits = id;
+    for (int8_t i = 3; i >= 0; i -= 1) {
+        const uint8_t digit = digits % 49;
+        digits /= 49;
+        (*body)[start + i] = (digit / 7) << 4 | digit % 7;
+        (*body)[start + 4 + i] = 0x06;
+    }
+}
+
+const uint16_t OVERSIZED_WIDTH = IMAGE_WIDTH * 5; // past any scale the firmware does
+
+// the capability headers of the request, see README
+struct Capabilities {
+    uint16_t panel_width = 0; // 0 without the header
+    uint16_t panel_height = 0;
+    bool rotate = false;
+    uint8_t max_scale = 1;
+    bool tiled = false;
+    int32_t free_slots = -1;
+};
+static Capabilities capabilities;
+static void parseFormats(const char *const formats) {
+    for (const char *item = formats; *item;) {
+        item += strspn(item, " ");
+        const size_t length = strcspn(item, ",");
+        const string format(item, length);
+        if (!format.compare(0, 5, "plain")) {
+            capabilities.rotate = format.find(";rotate") != string::npos;
+            const size_t scale = format.find(";scale=");
+            if (scale != string::npos) capabilities.max_scale = atoi(format.c_str() + scale + 7);
+        } else if (format == "tiled") capabilities.tiled = true;
+        item += length + (item[length] == ',');
+    }
+}
+// the rule of the plain format, see README
+static bool fits(const uint16_t width, const uint16_t height) {
+    if (!capabilities.panel_width) return true;
+    for (uint8_t scale = 1; scale <= capabilities.max_scale; scale += 1) {
+        const uint32_t scaled_width = ((uint32_t)width * 2 + scale - 1) / scale;
+        const uint32_t scaled_height = ((uint32_t)height + scale - 1) / scale;
+        if (scaled_width <= capabilities.panel_width * 2u && scaled_height <= capabilities.panel_height) return true;
+        if (capabilities.rotate && scaled_height <= capabilities.panel_width * 2u && scaled_width <= capabilities.panel_height) return true;
+    }
+    return false;
+}
+
+const uint8_t THEME_TILE_COUNT = 64;
+
+// the tiles the device has, taken from the request
+static uint32_t device_tiles = 0;
+static uint8_t device_generation = 0;
+static void startTileGeneration() {
+    world.tiles.clear();
+    world.tile_numbers.clear();
+    world.tile_generation += 1;
+}
+static void appendTiledImage(vector<uint8_t> *const body, const uint32_t id) {
+    vector<uint8_t> image;
+    appendImage(&image, id);
+    const uint8_t *const pixels = image.data() + 4;
+    const uint16_t tiles_x = (IMAGE_WIDTH + TILE_WIDTH - 1) / TILE_WIDTH;
+    const uint16_t tiles_y = (IMAGE_HEIGHT + TILE_WIDTH - 1) / TILE_WIDTH;
+
+    // a batch that didn't fit after all starts over in the middle
+    if (world.tiles.size() + tiles_x * tiles_y > MAX_TILE_COUNT) startTileGeneration();
+    if (device_generation != world.tile_generation || device_tiles > world.tiles.size()) device_tiles = 0;
+    device_generation = world.tile_generation;
+    const uint16_t first = device_tiles;
+    vector<uint16_t> numbers;
+    for (uint16_t tile_y = 0; tile_y < tiles_y; tile_y += 1) {
+        for (uint16_t tile_x = 0; tile_x < tiles_x; tile_x += 1) {
+            string tile(TILE_SIZE, 0x11);
+            // the first tile carries the id, the others are drawn from the theme or made up
+            if (!tile_x && !tile_y) {
+                for (uint8_t row = 0; row < TILE_WIDTH; row += 1) memcpy(&tile[row * TILE_WIDTH], pixels + row * IMAGE_WIDTH, TILE_WIDTH);
+            } else {
+                const uint64_t seed = world.chance(world.config.unique_tiles) ? world.rng() : world.rng() % THEME_TILE_COUNT;
+                for (uint8_t i = 0; i < TILE_SIZE; i += 1) tile[i] = (seed >> (i % 8 * 8)) % 7 * 0x11;
+            }
+            const auto found = world.tile_numbers.find(tile);
+            if (found != world.tile_numbers.end()) numbers.push_back(found->second);
+            else {
+                world.tile_numbers[tile] = world.tiles.size();
+                numbers.push_back(world.tiles.size());
+                world.tiles.push_back(tile);
+            }
+        }
+    }
+    const uint16_t count = world.tiles.size() - first;
+    device_tiles = world.tiles.size();
+
+    const uint16_t height = IMAGE_HEIGHT | TILED_IMAGE;
+    const uint8_t header[9] = { (uint8_t)(height & 0xff), (uint8_t)(height >> 8), IMAGE_WIDTH & 0xff, IMAGE_WIDTH >> 8, world.tile_generation,
+                                (uint8_t)(first & 0xff), (uint8_t)(first >> 8), (uint8_t)(count & 0xff), (uint8_t)(count >> 8) };
+    body->insert(body->end(), header, header + sizeof(header));
+    for (uint16_t i = first; i < first + count; i += 1) body->insert(body->end(), world.tiles[i].begin(), world.tiles[i].end());
+    for (const uint16_t number : numbers) {
+        body->push_back(number & 0xff);
+        body->push_back(number >> 8);
+    }
+}
+static void serveImage(vector<uint8_t> *const body, const uint32_t id, const bool tiled) {
+    if (tiled) appendTiledImage(body, id);
+    else appendImage(body, id);
+}
+
+static void serveRecent(vector<uint8_t> *const body) {
+    const uint8_t days = world.config.recent_days;
+    body->push_back(days);
+    // the coming night, a sync inside the night window serves the current one
+    const uint32_t first_night = world.night() + (world.epochUs() / 1000000 % 86400 >= 3 * 3600);
+    const uint32_t interval = world.config.recent_interval;
+    if (!interval) return;
+    for (uint8_t offset = 0; offset < days; offset += 1) {
+        if ((first_night + offset) % interval) continue;
+        const uint32_t id = world.next_image_id++;
+        body->push_back(offset);
+        serveImage(body, id, world.config.tiled);
+        world.expected[first_night + offset] = id;
+    }
+}
+static void serveRand(vector<uint8_t> *const body) {
+    body->push_back((uint8_t)world.config.server_min_file_count);
+    // a new dictionary replaces the saved images, so it starts with a batch that might not fit the old one,
+    // batches that would fill most of it on their own don't share enough to be tiled
+    const double tile_count = (double)((IMAGE_WIDTH + TILE_WIDTH - 1) / TILE_WIDTH) * ((IMAGE_HEIGHT + TILE_WIDTH - 1) / TILE_WIDTH);
+    const double expected = world.config.batch_size * (tile_count * world.config.unique_tiles + 1) + THEME_TILE_COUNT;
+    const bool negotiate = world.config.negotiate;
+    const bool tiled = world.config.tiled && 4 * expected <= MAX_TILE_COUNT && (capabilities.tiled || !negotiate);
+    if (tiled && world.tiles.size() + 2 * expected > MAX_TILE_COUNT) startTileGeneration();
+    uint32_t count = world.config.batch_size;
+    if (negotiate && capabilities.free_slots >= 0) count = min(count, (uint32_t)capabilities.free_slots);
+    // the server draws from a pool with some images no panel takes, it passes over them if the headers tell
+    for (uint32_t i = 0, drawn = 0; i < count && drawn < 4 * count; drawn += 1) {
+        if (world.config.oversized && world.chance(world.config.oversized)) {
+            if (negotiate && !fits(OVERSIZED_WIDTH, IMAGE_HEIGHT)) continue;
+            appendImage(body, world.next_image_id++, OVERSIZED_WIDTH);
+        } else serveImage(body, world.next_image_id++, tiled);
+        i += 1;
+    }
+}
+
+bool Http::begin(WiFiClient *const client, const char *const url) {
+    world.advance(50000); // dns and tcp
+    if (!world.wifi_link || world.chance(world.config.server_failure)) return false;
+    this->client = client;
+    path = url;
+    return true;
+}
+bool Http::header(const char *const name, const char *const value) {
+    if (header_count == HTTP_MAX_HEADERS) return false;
+    header_names[header_count] = name;
+    header_values[header_count] = value;
+    header_count += 1;
+    return true;
+}
+uint16_t Http::get() {
+    client->stop();
+    world.advance(100000); // first byte
+    capabilities = Capabilities();
+    device_generation = 0;
+    device_tiles = 0;
+    for (uint8_t i = 0; i < header_count; i += 1) {
+        const char *const value = header_values[i];
+        if (!strcmp(header_names[i], "X-Panel")) sscanf(value, "%hux%hu", &capabilities.panel_width, &capabilities.panel_height);
+        else if (!strcmp(header_names[i], "X-Image-Formats")) parseFormats(value);
+        else if (!strcmp(header_names[i], "X-Free-Slots")) capabilities.free_slots = atoi(value);
+        else if (!strcmp(header_names[i], "X-Tiles")) {
+            unsigned generation = 0, tiles = 0;
+            sscanf(value, "%u/%u", &generation, &tiles);
+            device_generation = generation;
+            device_tiles = tiles;
+        }
+    }
+    if (!strncmp(path, RECENT, strlen(RECENT))) serveRecent(&client->body);
+    else if (!strncmp(path, RANDOM, strlen(RANDOM))) serveRand(&client->body);
+    else if (strcmp(path, PALETTE)) return 404;
+    content_length = client->body.size();
+    return 200;
+}
+uint16_t Http::post(const uint8_t *const body, const size_t size) {
+    world.advance(100000 + size * 1e6 / world.config.throughput);
+    if (strcmp(path, REPORT)) return 404;
+    // the errors come before the battery, heap and sd records
+    for (size_t i = 0; i < size && body[i] < 251; i += 1) world.metrics.reported_errors += 1;
+    return 200;
+}
+WiFiClient *Http::getStreamPtr() {
+    return client;
+}
+int32_t Http::contentLength() {
+    return content_length;
+}
+void Http::end() {
+    if (client) client->stop();
+    client = nullptr;
+}
+void sampleHeap() {}
+tuple<uint32_t, uint8_t> heapWatermarks() {
+    return tuple(ESP.getFreeHeap(), ESP.getHeapFragmentation());
+}
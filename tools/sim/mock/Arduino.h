@@ -0,0 +1,63 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// just enough of the esp8266 arduino core for the firmware, backed by the simulated world
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include <time.h>
+#include "pins_arduino.h"
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t data) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size);
+};
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual size_t readBytes(uint8_t *buffer, size_t length);
+        size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+        void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+    protected:
+        unsigned long timeout = 1000;
+};
+
+class EspClass {
+    public:
+        bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+        bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+        [[noreturn]] void deepSleep(uint64_t time_us);
+        uint32_t getFreeHeap();
+        uint8_t getHeapFragmentation();
+};
+extern EspClass ESP;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+char *utoa(unsigned value, char *buffer, int base);
+
+void configTime(int timezone, int daylight_offset, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
+// the firmware reads the simulated clock
+int simGettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday simGettimeofday
+
+#endif // !ARDUINO_H
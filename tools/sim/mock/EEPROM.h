@@ -0,0 +1,22 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// writes only survive a deep sleep once committed, end() commits like the core does
+class EEPROMClass {
+    public:
+        void begin(size_t size);
+        uint8_t read(int address);
+        void write(int address, uint8_t value);
+        bool commit();
+        bool end();
+    private:
+        uint8_t data[4096];
+        size_t size = 0;
+        bool dirty = false;
+};
+extern EEPROMClass EEPROM;
+
+#endif // !EEPROM_H
@@ -0,0 +1,22 @@
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include "Arduino.h"
+
+enum WiFiMode_t { WIFI_OFF, WIFI_STA };
+enum WiFiPhyMode_t { WIFI_PHY_MODE_11B = 1, WIFI_PHY_MODE_11G = 2, WIFI_PHY_MODE_11N = 3 };
+enum wl_status_t { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 };
+
+class ESP8266WiFiClass {
+    public:
+        bool mode(WiFiMode_t mode);
+        void begin(const char *ssid, const char *passphrase);
+        int8_t waitForConnectResult(unsigned long timeout_ms);
+        int32_t RSSI();
+        bool disconnect();
+        void setOutputPower(float dbm);
+        bool setPhyMode(WiFiPhyMode_t mode) { return true; }
+};
+extern ESP8266WiFiClass WiFi;
+
+#endif // !ESP8266WIFI_H
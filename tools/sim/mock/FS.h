@@ -0,0 +1,59 @@
+#ifndef FS_H
+#define FS_H
+
+#include "Arduino.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MemoryFs;
+
+namespace fs {
+
+struct FileImpl;
+
+class File : public Stream {
+    public:
+        File() {}
+        File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+        size_t write(uint8_t data) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t readBytes(uint8_t *buffer, size_t length) override { return read(buffer, length); }
+        size_t read(uint8_t *buffer, size_t size);
+        bool seek(uint32_t position);
+        size_t position() const;
+        size_t size() const;
+        bool truncate(uint32_t size);
+        void flush() {}
+        void close();
+        const char *name() const;
+        bool isDirectory() const;
+        File openNextFile();
+        explicit operator bool() const { return (bool)impl; }
+
+    private:
+        std::shared_ptr<FileImpl> impl;
+};
+
+class FS {
+    public:
+        FS(MemoryFs *fs) : fs(fs) {}
+        bool begin();
+        void end();
+        File open(const char *path, const char *mode);
+        bool exists(const char *path);
+        bool remove(const char *path);
+        bool rename(const char *from, const char *to);
+    protected:
+        MemoryFs *fs;
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif // !FS_H
@@ -0,0 +1,17 @@
+#ifndef SD_H
+#define SD_H
+
+#include "FS.h"
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x02 // appends, like O_READ | O_WRITE | O_CREAT | O_APPEND
+
+class SDClass : public fs::FS {
+    public:
+        SDClass(MemoryFs *fs) : fs::FS(fs) {}
+        bool begin(uint8_t cs_pin);
+        File open(const char *path, uint8_t mode = FILE_READ);
+};
+extern SDClass SD;
+
+#endif // !SD_H
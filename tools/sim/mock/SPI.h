@@ -0,0 +1,24 @@
+#ifndef SPI_H
+#define SPI_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+    public:
+        SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+// every byte goes to the panel, the sd card is simulated above the bus
+class SPIClass {
+    public:
+        void begin() {}
+        void beginTransaction(SPISettings) {}
+        uint8_t transfer(uint8_t data);
+        void writeBytes(const uint8_t *data, uint32_t size);
+};
+extern SPIClass SPI;
+
+#endif // !SPI_H
@@ -0,0 +1,24 @@
+#ifndef WIFICLIENT_H
+#define WIFICLIENT_H
+
+#include "Arduino.h"
+#include <vector>
+
+// the http client is simulated as a whole, this only holds the response body
+class WiFiClient : public Stream {
+    public:
+        size_t write(uint8_t data) override { return 1; }
+        size_t write(const uint8_t *buffer, size_t size) override { return size; }
+        int available() override;
+        int read() override;
+        int read(uint8_t *buffer, size_t size);
+        int peek() override;
+        size_t readBytes(uint8_t *buffer, size_t length) override { return read(buffer, length); }
+        uint8_t connected();
+        void stop();
+
+        std::vector<uint8_t> body;
+        size_t position = 0;
+};
+
+#endif // !WIFICLIENT_H
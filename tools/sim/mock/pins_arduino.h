@@ -0,0 +1,18 @@
+#ifndef PINS_ARDUINO_H
+#define PINS_ARDUINO_H
+
+#include <cstdint>
+
+// d1 mini
+static const uint8_t D0 = 16;
+static const uint8_t D1 = 5;
+static const uint8_t D2 = 4;
+static const uint8_t D3 = 0;
+static const uint8_t D4 = 2;
+static const uint8_t D5 = 14;
+static const uint8_t D6 = 12;
+static const uint8_t D7 = 13;
+static const uint8_t D8 = 15;
+static const uint8_t A0 = 17;
+
+#endif // !PINS_ARDUINO_H
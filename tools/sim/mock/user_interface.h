@@ -0,0 +1,4 @@
+#ifndef USER_INTERFACE_H
+#define USER_INTERFACE_H
+
+#endif // !USER_INTERFACE_H
@@ -0,0 +1,228 @@
+// runs the firmware through simulated years of wakes, once for every combination of the swept parameters
+//
+// usage: sim [-j jobs] [-d days] [-s seed] [name=values]...
+//   values are a list (a,b,c) or a range (start:stop:step), the names are the fields of Config in world.h
+//   sim wake_interval=2,3 batch_size=10:60:10 connect_probability=0.8,0.95 > sweep.csv
+//
+// every combination starts from the same seed, so the rows differ by their parameters only
+
+#include "world.h"
+#include "storage.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+void setup();
+void bootFirmware();
+
+const uint64_t START_EPOCH = 1735689600; // 2025-01-01 00:00 UTC
+const uint64_t DAY_US = 86400000000;
+
+#define PARAM(name) { #name, &Config::name }
+const struct { const char *name; double Config::*field; } PARAMS[] = {
+    PARAM(min_file_count_error), PARAM(min_file_count_warning), PARAM(days_until_recent_check_error),
+    PARAM(days_until_recent_check_warning), PARAM(max_saved_image_count), PARAM(days_until_battery_check),
+    PARAM(default_min_file_count), PARAM(max_failed_wifi_connections), PARAM(wake_interval),
+    PARAM(server_min_file_count), PARAM(batch_size), PARAM(recent_days), PARAM(recent_interval), PARAM(server_failure), PARAM(tiled), PARAM(unique_tiles),
+    PARAM(oversized), PARAM(negotiate),
+    PARAM(connect_probability), PARAM(connect_ms), PARAM(throughput), PARAM(rssi), PARAM(ntp_ms),
+    PARAM(battery_mah), PARAM(drift), PARAM(cpu_ma), PARAM(wifi_ma), PARAM(sleep_ua), PARAM(panel_ma), PARAM(refresh_ms),
+    PARAM(sd_ma), PARAM(sd_op_ms), PARAM(sd_rate), PARAM(flash_op_ms), PARAM(flash_rate), PARAM(start_hour),
+};
+#undef PARAM
+
+struct Sweep {
+    double Config::*field;
+    const char *name;
+    vector<double> values;
+};
+
+static void applyTunables(const Config &config) {
+    MIN_FILE_COUNT_ERROR = config.min_file_count_error;
+    MIN_FILE_COUNT_WARNING = config.min_file_count_warning;
+    DAYS_UNTIL_RECENT_CHECK_ERROR = config.days_until_recent_check_error;
+    DAYS_UNTIL_RECENT_CHECK_WARNING = config.days_until_recent_check_warning;
+    MAX_SAVED_IMAGE_COUNT = config.max_saved_image_count;
+    DAYS_UNTIL_BATTERY_CHECK = config.days_until_battery_check;
+    DEFAULT_MIN_FILE_COUNT = config.default_min_file_count;
+    MAX_FAILED_WIFI_CONNECTIONS = config.max_failed_wifi_connections;
+    WAKE_INTERVAL = config.wake_interval;
+}
+
+static Metrics run(const Config &config, const uint32_t days, const uint64_t seed) {
+    world.~World();
+    new (&world) World();
+    world.config = config;
+    world.rng.seed(seed);
+    world.start_epoch = START_EPOCH;
+    world.wall_us = config.start_hour * 3600e6;
+    world.remaining_mah = config.battery_mah;
+    world.sd.sd = true;
+    world.flash.sd = false;
+    // fresh batteries, the rtc memory holds garbage and the eeprom is erased
+    for (uint8_t &byte : world.rtc) byte = world.rng();
+    memset(world.eeprom, 0xff, sizeof(world.eeprom));
+    applyTunables(config);
+
+    const uint64_t end_us = days * DAY_US;
+    while (world.wall_us < end_us) {
+        world.clock_us = 0;
+        world.wifi_on = false;
+        world.wifi_link = false;
+        world.ntp_at = UINT64_MAX;
+        world.busy_until = 0;
+        world.panel_command = false;
+        world.command = 0;
+        world.sd.mounted = false;
+        world.flash.mounted = false;
+        bootFirmware();
+        world.metrics.wakes += 1;
+
+        uint64_t sleep_us = 0;
+        try {
+            setup();
+        } catch (const DeepSleep &deep_sleep) {
+            sleep_us = deep_sleep.us;
+        }
+        world.wifi_on = false;
+        world.wall_us += world.clock_us;
+        if (!sleep_us || world.remaining_mah <= 0) {
+            world.dead = true;
+            break;
+        }
+
+        const double slept_us = sleep_us * (1 + config.drift);
+        const double mah = config.sleep_ua / 1000 * slept_us / 3600e6;
+        world.metrics.energy_mah += mah;
+        world.remaining_mah -= mah;
+        world.wall_us += slept_us;
+        if (world.remaining_mah <= 0) {
+            world.dead = true;
+            break;
+        }
+    }
+
+    Metrics &metrics = world.metrics;
+    metrics.life_days = min(world.wall_us, end_us) / (double)DAY_US;
+    // the night window starts the day, the first one is complete only if the batteries went in before it
+    const uint32_t first_night = config.start_hour > 0 ? 1 : 0;
+    for (uint32_t night = first_night; night < days; night += 1) if (!world.displayed.count(night)) metrics.missed_nights += 1;
+    for (const auto &[night, id] : world.expected) {
+        if (night >= days) continue;
+        metrics.scheduled_nights += 1;
+        const auto displayed = world.displayed.find(night);
+        if (displayed == world.displayed.end() || displayed->second != id) metrics.missed_scheduled += 1;
+    }
+    return metrics;
+}
+
+static bool parseSweep(const char *const arg, Sweep *const sweep) {
+    const char *const equals = strchr(arg, '=');
+    if (!equals) return false;
+    const string name(arg, equals - arg);
+    sweep->field = nullptr;
+    for (const auto &param : PARAMS) if (name == param.name) { sweep->field = param.field; sweep->name = param.name; }
+    if (!sweep->field) return false;
+
+    const char *const values = equals + 1;
+    double start, stop, step;
+    if (sscanf(values, "%lf:%lf:%lf", &start, &stop, &step) == 3) {
+        if (step <= 0) return false;
+        for (double value = start; value <= stop + step * 1e-9; value += step) sweep->values.push_back(value);
+        return true;
+    }
+    for (const char *value = values; *value;) {
+        char *end;
+        sweep->values.push_back(strtod(value, &end));
+        if (end == value) return false;
+        value = *end == ',' ? end + 1 : end;
+    }
+    return !sweep->values.empty();
+}
+
+int main(int argc, char **argv) {
+    uint32_t jobs = max(1u, thread::hardware_concurrency());
+    uint32_t days = 365;
+    uint64_t seed = 1;
+    vector<Sweep> sweeps;
+
+    for (int i = 1; i < argc; i += 1) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) jobs = max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) days = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+        else {
+            Sweep sweep;
+            if (!parseSweep(argv[i], &sweep)) {
+                fprintf(stderr, "sim: bad argument %s\n", argv[i]);
+                return 1;
+            }
+            sweeps.push_back(sweep);
+        }
+    }
+
+    size_t count = 1;
+    for (const Sweep &sweep : sweeps) count *= sweep.values.size();
+    vector<Config> configs(count);
+    for (size_t i = 0; i < count; i += 1) {
+        size_t rest = i;
+        for (auto sweep = sweeps.rbegin(); sweep != sweeps.rend(); ++sweep) {
+            configs[i].*sweep->field = sweep->values[rest % sweep->values.size()];
+            rest /= sweep->values.size();
+        }
+    }
+
+    // the firmware only wakes in every night and day window with these
+    for (const Config &config : configs) {
+        if (config.wake_interval != 1 && config.wake_interval != 2 && config.wake_interval != 3) {
+            fprintf(stderr, "sim: wake_interval must be 1, 2 or 3\n");
+            return 1;
+        }
+    }
+
+    // the firmware keeps its state in globals, so every worker is a process of its own
+    Metrics *const results = (Metrics *)mmap(nullptr, sizeof(Metrics) * count, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("sim: mmap");
+        return 1;
+    }
+    jobs = min<size_t>(jobs, count);
+    for (uint32_t job = 0; job < jobs; job += 1) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            perror("sim: fork");
+            return 1;
+        }
+        if (pid) continue;
+        for (size_t i = job; i < count; i += jobs) results[i] = run(configs[i], days, seed);
+        _exit(0);
+    }
+    bool failed = false;
+    for (int status; wait(&status) > 0;) if (!WIFEXITED(status) || WEXITSTATUS(status)) failed = true;
+    if (failed) {
+        fprintf(stderr, "sim: a worker failed\n");
+        return 1;
+    }
+
+    for (const Sweep &sweep : sweeps) printf("%s,", sweep.name);
+    printf("energy_mah,life_days,wakes,wifi_sessions,bytes_downloaded,sd_ops,sd_bytes,flash_ops,refreshes,"
+           "missed_nights,scheduled_nights,missed_scheduled,repeats,reported_errors\n");
+    for (size_t i = 0; i < count; i += 1) {
+        for (const Sweep &sweep : sweeps) printf("%g,", configs[i].*sweep.field);
+        const Metrics &m = results[i];
+        printf("%.1f,%.1f,%u,%u,%llu,%llu,%llu,%llu,%u,%u,%u,%u,%u,%u\n", m.energy_mah, m.life_days, m.wakes, m.wifi_sessions,
+               (unsigned long long)m.bytes_downloaded, (unsigned long long)m.sd_ops, (unsigned long long)m.sd_bytes,
+               (unsigned long long)m.flash_ops, m.refreshes, m.missed_nights, m.scheduled_nights, m.missed_scheduled,
+               m.repeats, m.reported_errors);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+// the simulated surroundings of one device, shared by the mocks and the driver
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+struct Config {
+    // firmware tunables, see storage.h
+    double min_file_count_error = 128;
+    double min_file_count_warning = 64;
+    double days_until_recent_check_error = 64;
+    double days_until_recent_check_warning = 32;
+    double max_saved_image_count = 64;
+    double days_until_battery_check = 7;
+    double default_min_file_count = 30;
+    double max_failed_wifi_connections = 3;
+    double wake_interval = 3;         // h
+
+    // server
+    double server_min_file_count = 30;
+    double batch_size = 30;           // images per random response
+    double recent_days = 7;           // days until the next recent check
+    double recent_interval = 0;       // a scheduled image every n nights, 0 for none
+    double server_failure = 0.01;     // probability of a failed request
+    double tiled = 0;                 // 1 to serve the images as tiles
+    double unique_tiles = 0.2;        // share of the tiles of an image not taken from the common theme
+    double oversized = 0;             // share of the random images too large for any panel
+    double negotiate = 1;             // 1 if the server leaves out what the request headers say won't fit
+
+    // link
+    double connect_probability = 0.95;
+    double connect_ms = 2500;
+    double throughput = 60000;        // B/s
+    double rssi = -70;                // dBm
+    double ntp_ms = 300;
+
+    // device
+    double battery_mah = 3000;
+    double drift = 0.01;              // the deep sleep timer runs this much long
+    double cpu_ma = 20;
+    double wifi_ma = 75;              // at full power
+    double sleep_ua = 25;
+    double panel_ma = 10;             // on top of the cpu while refreshing
+    double refresh_ms = 12000;
+    double sd_ma = 30;
+    double sd_op_ms = 4;              // open, remove, rename
+    double sd_rate = 400000;          // B/s
+    double flash_op_ms = 1;
+    double flash_rate = 1000000;      // B/s
+    double start_hour = 10;           // UTC, when the batteries go in
+};
+
+struct Metrics {
+    double energy_mah = 0;
+    double life_days = 0;             // until the battery ran out or the firmware terminated
+    uint32_t wakes = 0;
+    uint32_t wifi_sessions = 0;
+    uint64_t bytes_downloaded = 0;
+    uint64_t sd_ops = 0;
+    uint64_t sd_bytes = 0;
+    uint64_t flash_ops = 0;
+    uint32_t refreshes = 0;
+    uint32_t missed_nights = 0;       // nights without an image
+    uint32_t scheduled_nights = 0;
+    uint32_t missed_scheduled = 0;    // scheduled nights showing something else
+    uint32_t repeats = 0;             // images displayed again
+    uint32_t reported_errors = 0;
+};
+
+struct MemoryFs {
+    std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+    bool mounted = false;
+    bool sd;                          // otherwise the internal flash
+};
+
+struct DeepSleep {
+    uint64_t us;                      // 0 if the firmware terminated
+};
+
+struct World {
+    Config config;
+    Metrics metrics;
+    std::mt19937_64 rng;
+
+    uint64_t wall_us = 0;             // since the start of the simulation, at the start of the wake
+    uint64_t clock_us = 0;            // since the start of the wake
+    uint64_t start_epoch = 0;         // unix time of the start
+    double remaining_mah = 0;
+    bool dead = false;
+
+    uint8_t rtc[512];
+    uint8_t eeprom[4096];
+
+    MemoryFs sd;
+    MemoryFs flash;
+
+    // radio
+    bool wifi_on = false;
+    bool wifi_link = false;           // decided when the connection begins
+    uint64_t wifi_connected_at = 0;
+    float tx_power = 20.5;
+    uint64_t ntp_at = UINT64_MAX;
+
+    // panel
+    bool panel_command = false;
+    uint8_t command = 0;
+    uint32_t data_index = 0;
+    uint8_t marker[8];
+    uint64_t busy_until = 0;
+    std::set<uint32_t> shown;
+    std::map<uint32_t, uint32_t> displayed; // night, image id
+    std::map<uint32_t, uint32_t> expected;  // night, scheduled image id
+    uint32_t next_image_id = 1;
+    std::vector<std::string> tiles;   // the server's dictionary
+    uint8_t tile_generation = 1;
+    std::map<std::string, uint16_t> tile_numbers;
+
+    // wake clock, charged at the current draw of the moment
+    void advance(const double us, const double extra_ma = 0);
+    bool chance(const double probability);
+    uint64_t epochUs() const;
+    uint32_t night() const;           // days since the start, the night window begins the day
+};
+
+extern World world;
+
+#endif // !WORLD_H